@@ -0,0 +1,10 @@
+cmake_minimum_required(VERSION 3.1)
+
+# Read the resulting HEX content into variable
+file(READ ${SNAPSHOT_HEX_FILE} SNAPSHOT_HEX)
+
+# Snapshots are looked up by the name of the game they were taken from
+string(REGEX REPLACE "\\." "_" SNAPSHOT_CLASS ${SNAPSHOT_GAME})
+
+# Substitute encoded HEX content into template source file
+configure_file("${SOURCE_DIR}/src/Snapshot.cpp.in" ${SNAPSHOT_EMBED_FILE})
@@ -0,0 +1,206 @@
+// Headless benchmark of the emulation core: starts each embedded game as
+// the menu does, from its post-load snapshot, and runs it flat out for a
+// fixed number of frames, with no display, sound or speed regulation, then
+// reports how fast the core went. Switching to each game is timed too,
+// through the same Games::leave() and Games::enter() as the menu, and so is
+// going back to the game before the last, which is resumed where it was.
+// Given "tape", each game boots from its tape instead, so the frames run
+// include loading it; it isn't an option, as Fuse's --tape takes a file.
+//
+// Usage: anthology_bench [tape] [frames]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "games.h"
+
+extern "C"
+{
+#include <config.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "machine.h"
+#include "rewind.h"
+#include "rzx.h"
+#include "z80/z80.h"
+}
+
+using namespace std;
+
+extern "C" int machine_init();
+extern "C" int first_arg;
+
+// Frames to run each game for, if not given on the command line.
+static const int default_frames = 3000;
+
+class Bench
+{
+	const string& filename;
+	const int igame;
+
+	// Count of Z80 M1 cycles so far. Every opcode fetch (and every HALT
+	// cycle) increments R, and LD R,A compensates through the RZX
+	// offset, so their sum only ever grows by one per M1 cycle. That is
+	// one per unprefixed instruction, but two for the CB, DD, ED and FD
+	// prefixed ones, so it isn't a count of instructions. Only the low
+	// 16 bits of it are meaningful.
+	static libspectrum_word m1_cycles()
+	{
+		return z80.r + rzx_instructions_offset;
+	}
+
+public :
+
+	int frames;
+	libspectrum_qword ntstates;
+	libspectrum_qword nm1;
+	double seconds;
+	double switch_seconds;
+
+	Bench(const string& filename_, const int igame_) :
+		filename(filename_), igame(igame_), frames(0), ntstates(0),
+		nm1(0), seconds(0), switch_seconds(0) { }
+
+	// Time leaving game #from, if there is one, for game #to, as the
+	// menu switches between them. Games::enter() also drops the timer
+	// event, which would hold emulation at real time.
+	static double switch_games(const int from, const int to)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		if (from >= 0)
+			Games::leave(from, true);
+		Games::enter(to);
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		// Starting to record history is part of the switch, but
+		// recording it every frame would be timed as the core's speed
+		rewind_stop();
+
+		return seconds;
+	}
+
+	void run(int nframes, int previous)
+	{
+		switch_seconds = switch_games(previous, igame);
+
+		libspectrum_word last_m1_cycles = m1_cycles();
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		while (frames < nframes)
+		{
+			z80_do_opcodes();
+
+			libspectrum_word now = m1_cycles();
+			nm1 += (libspectrum_word)(now - last_m1_cycles);
+			last_m1_cycles = now;
+
+			libspectrum_dword at_event = tstates;
+			event_do_events();
+
+			// The end of frame event winds the clock back by a frame
+			if (tstates < at_event)
+			{
+				frames++;
+				ntstates += machine_current->timings.tstates_per_frame;
+			}
+		}
+
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void report() const
+	{
+		print_result(filename, frames, seconds, ntstates, nm1, switch_seconds);
+	}
+
+	static void print_result(const string& name, int frames, double seconds,
+		libspectrum_qword ntstates, libspectrum_qword nm1, double switch_seconds)
+	{
+		printf("%-12s %6d frames %8.3f s %9.2f MHz %9.1f fps %8.2f ns/M1 %7.3f ms switch\n",
+			name.c_str(), frames, seconds, ntstates / seconds / 1e6, frames / seconds,
+			nm1 ? seconds * 1e9 / nm1 : 0.0, switch_seconds * 1e3);
+	}
+};
+
+extern "C" int ui_init(int *argc, char ***argv)
+{
+	int arg = first_arg;
+
+	// Without the snapshots, Games::enter() boots each game from its tape
+	if (arg < *argc && !strcmp((*argv)[arg], "tape"))
+	{
+		snapshot_sources.reset();
+		arg++;
+	}
+
+	int nframes = default_frames;
+	if (arg < *argc)
+	{
+		nframes = atoi((*argv)[arg]);
+		if (nframes <= 0)
+		{
+			fprintf(stderr, "Frame count must be positive: \"%s\"\n", (*argv)[arg]);
+			exit(-1);
+		}
+	}
+
+	if (!game_sources.get())
+	{
+		fprintf(stderr, "Game sources list is empty\n");
+		exit(-1);
+	}
+
+	if (machine_init())
+	{
+		fprintf(stderr, "Failed to initialize the machine\n");
+		exit(-1);
+	}
+
+	libspectrum_qword ntstates = 0;
+	libspectrum_qword nm1 = 0;
+	int frames = 0;
+	double seconds = 0;
+	double switch_seconds = 0;
+	int igame = 0;
+
+	for (map<string, vector<char> >::iterator i = game_sources->begin(), e = game_sources->end(); i != e; i++, igame++)
+	{
+		Bench bench(i->first, igame);
+		bench.run(nframes, igame - 1);
+
+		bench.report();
+
+		ntstates += bench.ntstates;
+		nm1 += bench.nm1;
+		frames += bench.frames;
+		seconds += bench.seconds;
+		switch_seconds = max(switch_seconds, bench.switch_seconds);
+	}
+
+	// The slowest switch is what matters against the one frame budget
+	Bench::print_result("total", frames, seconds, ntstates, nm1, switch_seconds);
+
+	// Going back to the game before the last finds it still suspended
+	if (igame >= 2)
+	{
+		double resume_seconds = Bench::switch_games(igame - 1, igame - 2);
+		printf("%-12s %7.3f ms switch\n", "resume", resume_seconds * 1e3);
+		Games::leave(igame - 2, false);
+	}
+	else if (igame)
+		Games::leave(igame - 1, false);
+
+	exit(0);
+}
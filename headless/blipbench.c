@@ -0,0 +1,223 @@
+/* blipbench.c: Microbenchmark for the band-limited sound synthesis
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Feeds the blip buffers what a frame of stereo AY music looks like: the
+   beeper and Specdrum on both channels, and three tone channels spread
+   over the left, right and both, each toggling every hundred or so
+   tstates. The frame is then read back as interleaved stereo, as
+   sound_frame() does. This is run once for each version of the synthesis
+   this machine supports, so the time reported is all spent in
+   blipbuffer.c.
+
+   Usage: anthology_blipbench [frames] */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "sound/blipbuffer.h"
+#include "ui/ui.h"
+
+extern int first_arg;
+
+/* Frames to run for, if not given on the command line */
+static const int default_frames = 20000;
+
+static const long frame_length = 69888;
+
+/* Half periods of the tone channels in tstates */
+static const long tone_periods[] = { 113, 151, 227 };
+
+#define CHANNELS 2
+#define SAMPLE_RATE 44100
+#define FRAME_SAMPLES ( SAMPLE_RATE / 50 + 1 )
+
+/* The tone channels are A on the left, C on the right and B on both */
+static const int tone_outputs[] = { 1, 3, 2 };
+
+static Blip_Buffer *bufs[ CHANNELS ];
+static Blip_Synth *beeper[ CHANNELS ], *specdrum[ CHANNELS ];
+static Blip_Synth *tones[ 3 ][ CHANNELS ];
+
+static unsigned int random_state = 1;
+
+static unsigned int
+bench_random( void )
+{
+  random_state = random_state * 1103515245 + 12345;
+  return ( random_state >> 16 ) & 0x7fff;
+}
+
+static Blip_Synth*
+synth_new( Blip_Buffer *buf, double volume )
+{
+  Blip_Synth *synth = new_Blip_Synth();
+
+  if( !synth ) {
+    fprintf( stderr, "Out of memory\n" );
+    exit( 1 );
+  }
+
+  blip_synth_set_volume( synth, volume );
+  blip_synth_set_output( synth, buf );
+  blip_synth_set_treble_eq( synth, -37.0 );
+
+  return synth;
+}
+
+static void
+channels_new( void )
+{
+  int i, tone;
+
+  for( i = 0; i < CHANNELS; i++ ) {
+    bufs[i] = new_Blip_Buffer();
+    if( !bufs[i] ) {
+      fprintf( stderr, "Out of memory\n" );
+      exit( 1 );
+    }
+
+    blip_buffer_set_clock_rate( bufs[i], 3546900 );
+    if( blip_buffer_set_sample_rate( bufs[i], SAMPLE_RATE, 1000 ) ) {
+      fprintf( stderr, "Out of memory\n" );
+      exit( 1 );
+    }
+    blip_buffer_set_bass_freq( bufs[i], 16 );
+
+    beeper[i] = synth_new( bufs[i], 0.5 );
+    specdrum[i] = synth_new( bufs[i], 0.5 );
+
+    for( tone = 0; tone < 3; tone++ )
+      tones[ tone ][i] =
+        ( tone_outputs[ tone ] & ( 1 << i ) ) ? synth_new( bufs[i], 0.3 ) :
+                                                NULL;
+  }
+}
+
+static void
+channels_free( void )
+{
+  int i, tone;
+
+  for( i = 0; i < CHANNELS; i++ ) {
+    delete_Blip_Synth( &beeper[i] );
+    delete_Blip_Synth( &specdrum[i] );
+    for( tone = 0; tone < 3; tone++ ) delete_Blip_Synth( &tones[ tone ][i] );
+    delete_Blip_Buffer( &bufs[i] );
+  }
+}
+
+/* One frame's worth of edges and reading; returns the number of edges */
+static long
+frame( blip_sample_t *samples )
+{
+  long t, edges = 0;
+  int tone, i, level[3] = { 0, 0, 0 };
+
+  for( tone = 0; tone < 3; tone++ ) {
+    for( t = bench_random() % tone_periods[ tone ]; t < frame_length;
+         t += tone_periods[ tone ] ) {
+      level[ tone ] = !level[ tone ];
+      for( i = 0; i < CHANNELS; i++ )
+        if( tones[ tone ][i] ) {
+          blip_synth_update( tones[ tone ][i], t, level[ tone ] * 8000 );
+          edges++;
+        }
+    }
+  }
+
+  /* A beeper click and a few drum samples */
+  for( i = 0; i < CHANNELS; i++ ) {
+    blip_synth_update( beeper[i], bench_random() % frame_length,
+                       ( bench_random() & 1 ) * 12000 );
+    edges++;
+
+    for( t = 0; t < frame_length; t += 2000 + bench_random() % 2000 ) {
+      blip_synth_update( specdrum[i], t, ( bench_random() % 256 - 128 ) * 128 );
+      edges++;
+    }
+  }
+
+  for( i = 0; i < CHANNELS; i++ )
+    blip_buffer_end_frame( bufs[i], frame_length );
+
+  blip_buffer_read_samples_stereo( bufs[0], bufs[1], samples, FRAME_SAMPLES );
+
+  return edges;
+}
+
+static double
+now( void )
+{
+  struct timeval tv;
+
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+ui_init( int *argc, char ***argv )
+{
+  int frames = default_frames, frames_done, simd;
+  blip_sample_t samples[ FRAME_SAMPLES * CHANNELS ];
+  unsigned long checksum;
+  double start, seconds;
+  long edges;
+  size_t i;
+
+  if( first_arg < *argc ) {
+    frames = atoi( (*argv)[ first_arg ] );
+    if( frames <= 0 ) {
+      fprintf( stderr, "Frame count must be positive: \"%s\"\n",
+               (*argv)[ first_arg ] );
+      exit( 1 );
+    }
+  }
+
+  for( simd = BLIP_SIMD_NONE; simd < BLIP_SIMD_COUNT; simd++ ) {
+    if( blip_simd_select( simd ) ) continue;
+
+    random_state = 1;
+    checksum = 0;
+    edges = 0;
+    channels_new();
+
+    start = now();
+
+    for( frames_done = 0; frames_done < frames; frames_done++ )
+      edges += frame( samples );
+
+    seconds = now() - start;
+
+    /* The reader's state depends on every frame before, so the last
+       frame's samples stand for the lot */
+    for( i = 0; i < FRAME_SAMPLES * CHANNELS; i++ )
+      checksum = checksum * 31 + (unsigned short)samples[i];
+
+    channels_free();
+
+    /* The checksums should all be the same */
+    printf( "%-6s %d frames, %ld edges in %.3f s: %.2f us/frame "
+            "(checksum %08lx)\n", blip_simd_name( simd ), frames, edges,
+            seconds, seconds * 1e6 / frames, checksum & 0xffffffff );
+  }
+
+  exit( 0 );
+}
@@ -0,0 +1,176 @@
+/* eventbench.c: Microbenchmark for the event queue
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Drives the event queue with the pattern it sees while a tape is
+   loading: a stream of edge events a few hundred to a couple of thousand
+   tstates apart, the end of frame and timer events, and a handful of
+   long-lived events from other peripherals which sit in the queue and
+   get rebased every frame. No Z80 code is run, so the time reported is
+   all spent in event.c.
+
+   Usage: anthology_eventbench [frames] */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "spectrum.h"
+#include "ui/ui.h"
+
+extern int first_arg;
+
+/* Frames to run for, if not given on the command line */
+static const int default_frames = 200000;
+
+static const libspectrum_dword frame_length = 69888;
+
+/* Edge lengths from the ROM loader: pilot, two sync pulses and the two
+   bit lengths */
+static const libspectrum_dword edge_lengths[] = { 2168, 667, 735, 855, 1710 };
+
+/* Number of long-lived events kept in the queue */
+#define BACKGROUND_EVENTS 8
+
+static int edge_event, frame_event, timer_event_type, background_event;
+
+static unsigned long events_done;
+static unsigned int edge_count;
+static unsigned int random_state = 1;
+
+static unsigned int
+bench_random( void )
+{
+  random_state = random_state * 1103515245 + 12345;
+  return ( random_state >> 16 ) & 0x7fff;
+}
+
+static void
+edge( libspectrum_dword last_tstates, int type, void *user_data )
+{
+  libspectrum_dword length;
+
+  events_done++;
+
+  /* Mostly pilot tone and data bits, as in a real block */
+  if( edge_count++ % 4000 < 3223 )
+    length = edge_lengths[0];
+  else
+    length = edge_lengths[ 3 + bench_random() % 2 ];
+
+  event_add_with_data( last_tstates + length, type, user_data );
+}
+
+static void
+frame( libspectrum_dword last_tstates, int type, void *user_data )
+{
+  events_done++;
+
+  tstates -= frame_length;
+  event_frame( frame_length );
+  event_add( frame_length, type );
+}
+
+static void
+timer( libspectrum_dword last_tstates, int type, void *user_data )
+{
+  events_done++;
+
+  event_add( last_tstates + frame_length, type );
+}
+
+static void
+background( libspectrum_dword last_tstates, int type, void *user_data )
+{
+  events_done++;
+
+  event_add_with_data( last_tstates + 4 * frame_length +
+                         bench_random() * 16, type, user_data );
+}
+
+static double
+now( void )
+{
+  struct timeval tv;
+
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+ui_init( int *argc, char ***argv )
+{
+  int frames = default_frames, frames_done = 0;
+  libspectrum_dword frame_start;
+  double start, seconds;
+  size_t i;
+
+  if( first_arg < *argc ) {
+    frames = atoi( (*argv)[ first_arg ] );
+    if( frames <= 0 ) {
+      fprintf( stderr, "Frame count must be positive: \"%s\"\n",
+               (*argv)[ first_arg ] );
+      exit( 1 );
+    }
+  }
+
+  edge_event = event_register( edge, "Tape edge" );
+  frame_event = event_register( frame, "End of frame" );
+  timer_event_type = event_register( timer, "Timer" );
+  background_event = event_register( background, "Background" );
+
+  event_reset();
+  tstates = 0;
+
+  event_add( frame_length, frame_event );
+  event_add( 1000, timer_event_type );
+  event_add( edge_lengths[0], edge_event );
+  for( i = 0; i < BACKGROUND_EVENTS; i++ )
+    event_add_with_data( bench_random() * 16, background_event, (void*)i );
+
+  start = now();
+
+  while( frames_done < frames ) {
+    frame_start = tstates;
+
+    /* What z80_do_opcodes() does as far as events are concerned */
+    tstates = event_next_event;
+    event_do_events();
+
+    if( tstates < frame_start ) {
+      frames_done++;
+
+      /* Tapes get stopped and restarted between blocks */
+      if( frames_done % 100 == 0 ) {
+        event_remove_type( edge_event );
+        event_add( tstates + edge_lengths[0], edge_event );
+      }
+    }
+  }
+
+  seconds = now() - start;
+
+  printf( "%d frames, %lu events in %.3f s: %.1f ns/event\n", frames,
+          events_done, seconds, seconds * 1e9 / events_done );
+
+  exit( 0 );
+}
@@ -0,0 +1,224 @@
+/* nullui.c: A user interface which does nothing, for headless tools
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Everything the emulation core expects from the UI layer, minus the
+   UI. Each headless tool links this in place of the gtk*.c files and
+   supplies its own ui_init(), which is where it does its work. */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "display.h"
+#include "fuse.h"
+#include "keyboard.h"
+#include "ui/ui.h"
+#include "ui/uidisplay.h"
+#include "ui/uijoystick.h"
+
+/* No UI keysyms to map */
+keysyms_map_t keysyms_map[] = {
+  { 0, 0 }
+};
+
+int
+ui_event( void )
+{
+  return 0;
+}
+
+int
+ui_end( void )
+{
+  return 0;
+}
+
+int
+ui_error_specific( ui_error_level severity GCC_UNUSED,
+                   const char *message GCC_UNUSED )
+{
+  /* ui_verror() has already printed the message to stderr */
+  return 0;
+}
+
+int
+ui_widgets_reset( void )
+{
+  return 0;
+}
+
+int
+ui_menu_item_set_active( const char *path GCC_UNUSED, int active GCC_UNUSED )
+{
+  return 0;
+}
+
+ui_confirm_save_t
+ui_confirm_save_specific( const char *message GCC_UNUSED )
+{
+  return UI_CONFIRM_SAVE_DONTSAVE;
+}
+
+ui_confirm_joystick_t
+ui_confirm_joystick( libspectrum_joystick libspectrum_type GCC_UNUSED,
+                     int inputs GCC_UNUSED )
+{
+  return UI_CONFIRM_JOYSTICK_NONE;
+}
+
+int
+ui_query( const char *message GCC_UNUSED )
+{
+  return 0;
+}
+
+char*
+ui_get_open_filename( const char *title GCC_UNUSED )
+{
+  return NULL;
+}
+
+char*
+ui_get_save_filename( const char *title GCC_UNUSED )
+{
+  return NULL;
+}
+
+int
+ui_get_rollback_point( GSList *points GCC_UNUSED )
+{
+  return -1;
+}
+
+int
+ui_tape_browser_update( ui_tape_browser_update_type change GCC_UNUSED,
+                        libspectrum_tape_block *block GCC_UNUSED )
+{
+  return 0;
+}
+
+void
+ui_pokemem_selector( const char *filename GCC_UNUSED )
+{
+}
+
+int
+ui_mouse_grab( int startup GCC_UNUSED )
+{
+  return 0;
+}
+
+int
+ui_mouse_release( int suspend GCC_UNUSED )
+{
+  return 0;
+}
+
+int
+ui_debugger_activate( void )
+{
+  return 0;
+}
+
+int
+ui_debugger_deactivate( int interruptable GCC_UNUSED )
+{
+  return 0;
+}
+
+int
+ui_debugger_update( void )
+{
+  return 0;
+}
+
+int
+ui_debugger_disassemble( libspectrum_word address GCC_UNUSED )
+{
+  return 0;
+}
+
+int
+ui_joystick_init( void )
+{
+  return 0;
+}
+
+void
+ui_joystick_end( void )
+{
+}
+
+void
+ui_joystick_poll( void )
+{
+}
+
+int
+uidisplay_init( int width GCC_UNUSED, int height GCC_UNUSED )
+{
+  display_ui_initialised = 1;
+  return 0;
+}
+
+int
+uidisplay_end( void )
+{
+  return 0;
+}
+
+int
+uidisplay_hotswap_gfx_mode( void )
+{
+  return 0;
+}
+
+void
+uidisplay_area( int x GCC_UNUSED, int y GCC_UNUSED, int w GCC_UNUSED,
+                int h GCC_UNUSED )
+{
+}
+
+void
+uidisplay_frame_end( void )
+{
+}
+
+void
+uidisplay_putpixel( int x GCC_UNUSED, int y GCC_UNUSED, int colour GCC_UNUSED )
+{
+}
+
+void
+uidisplay_plot8( int x GCC_UNUSED, int y GCC_UNUSED,
+                 libspectrum_byte data GCC_UNUSED,
+                 libspectrum_byte ink GCC_UNUSED,
+                 libspectrum_byte paper GCC_UNUSED )
+{
+}
+
+void
+uidisplay_plot16( int x GCC_UNUSED, int y GCC_UNUSED,
+                  libspectrum_word data GCC_UNUSED,
+                  libspectrum_byte ink GCC_UNUSED,
+                  libspectrum_byte paper GCC_UNUSED )
+{
+}
@@ -0,0 +1,144 @@
+/* snapgen.c: Snapshot a game once it has loaded from tape
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Run at build time for each embedded game: autoloads the tape, runs the
+   machine flat out until the tape has played and then stayed stopped for
+   a few seconds, and writes a snapshot of the machine as it was when the
+   tape stopped. The game starts from the snapshot instead of going
+   through the loader.
+
+   Usage: anthology_snapgen <tape> <snapshot> */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "machine.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "tape.h"
+#include "timer/timer.h"
+#include "z80/z80.h"
+
+int machine_init( void );
+
+extern int first_arg;
+
+/* Frames the tape must stay stopped for before loading counts as having
+   finished when it stopped; long enough to ride out the gaps between
+   blocks */
+static const int quiet_frames = 250;
+
+/* Give up on a tape which is still loading after this many frames */
+static const int max_frames = 50 * 60 * 15;
+
+/* Run to the end of the current frame */
+static void
+run_frame( void )
+{
+  libspectrum_dword at_event;
+
+  while( 1 ) {
+    z80_do_opcodes();
+
+    /* The end of frame event winds the clock back by a frame */
+    at_event = tstates;
+    event_do_events();
+    if( tstates < at_event ) break;
+  }
+}
+
+int
+ui_init( int *argc, char ***argv )
+{
+  const char *tape_file, *snapshot_file;
+  int frames, stopped_for = 0, played = 0, loaded_in = 0;
+  libspectrum_snap *loaded = NULL;
+
+  if( *argc - first_arg != 2 ) {
+    fprintf( stderr, "Usage: %s <tape> <snapshot>\n", (*argv)[0] );
+    exit( 1 );
+  }
+
+  tape_file = (*argv)[ first_arg ];
+  snapshot_file = (*argv)[ first_arg + 1 ];
+
+  /* Loading is followed by watching the tape play, so it mustn't be
+     short-circuited by the ROM loader traps, and the tape must stop
+     when the loader does */
+  settings_current.tape_traps = 0;
+  settings_current.detect_loader = 1;
+
+  if( machine_init() ) {
+    fprintf( stderr, "Failed to initialize the machine\n" );
+    exit( 1 );
+  }
+
+  if( tape_open( tape_file, 1 ) ) {
+    fprintf( stderr, "Error loading tape \"%s\"\n", tape_file );
+    exit( 1 );
+  }
+
+  /* Run flat out: the timer event would hold us at real time */
+  event_remove_type( timer_event );
+
+  for( frames = 0; frames < max_frames; frames++ ) {
+    run_frame();
+
+    if( tape_is_playing() ) {
+      played = 1;
+      stopped_for = 0;
+    } else if( played ) {
+
+      /* Keep the machine as it was when the tape stopped, in case this
+         is the end of loading */
+      if( !stopped_for ) {
+        if( loaded ) libspectrum_snap_free( loaded );
+        loaded = libspectrum_snap_alloc();
+        if( snapshot_copy_to( loaded ) ) {
+          fprintf( stderr, "Error taking snapshot of \"%s\"\n", tape_file );
+          exit( 1 );
+        }
+        loaded_in = frames + 1;
+      }
+
+      if( ++stopped_for == quiet_frames ) break;
+    }
+  }
+
+  if( frames == max_frames ) {
+    fprintf( stderr, "Tape \"%s\" still loading after %d frames\n",
+             tape_file, max_frames );
+    exit( 1 );
+  }
+
+  if( snapshot_copy_from( loaded ) || snapshot_write( snapshot_file ) ) {
+    fprintf( stderr, "Error writing snapshot \"%s\"\n", snapshot_file );
+    exit( 1 );
+  }
+
+  libspectrum_snap_free( loaded );
+
+  printf( "%s: loaded in %d frames\n", tape_file, loaded_in );
+
+  exit( 0 );
+}
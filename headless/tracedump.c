@@ -0,0 +1,120 @@
+/* tracedump.c: Print a binary execution trace
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Decodes a trace written by the trace recorder into one line per
+   instruction: when it ran, where, what was paged in there, the
+   disassembled instruction and the registers before it ran. The
+   disassembly is done by the debugger's own disassembler, by pointing the
+   memory map at a scratch copy of each instruction's bytes.
+
+   Usage: anthology_tracedump <trace> */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "debugger/debugger.h"
+#include "memory.h"
+#include "trace.h"
+
+int machine_init( void );
+
+extern int first_arg;
+
+static libspectrum_byte scratch[ 0x10000 ];
+
+int
+ui_init( int *argc, char ***argv )
+{
+  const char *filename;
+  FILE *f;
+  trace_header header;
+  trace_record record;
+  char instruction[ 40 ];
+  size_t i, length;
+
+  if( *argc - first_arg != 1 ) {
+    fprintf( stderr, "Usage: %s <trace>\n", (*argv)[0] );
+    exit( 1 );
+  }
+
+  filename = (*argv)[ first_arg ];
+
+  /* For the memory source names */
+  if( machine_init() ) {
+    fprintf( stderr, "Failed to initialize the machine\n" );
+    exit( 1 );
+  }
+
+  f = fopen( filename, "rb" );
+  if( !f ) {
+    fprintf( stderr, "Couldn't open trace \"%s\"\n", filename );
+    exit( 1 );
+  }
+
+  if( fread( &header, sizeof( header ), 1, f ) != 1 ||
+      memcmp( header.magic, TRACE_MAGIC, 4 ) ) {
+    fprintf( stderr, "\"%s\" is not a trace\n", filename );
+    exit( 1 );
+  }
+
+  if( header.byte_order != TRACE_BYTE_ORDER ||
+      header.version != TRACE_VERSION ||
+      header.record_size != sizeof( record ) ) {
+    fprintf( stderr, "\"%s\" was written by a different version or machine\n",
+             filename );
+    exit( 1 );
+  }
+
+  /* The disassembler reads through memory_map_read[] */
+  for( i = 0; i < MEMORY_PAGES_IN_64K; i++ )
+    memory_map_read[i].page = &scratch[ i * MEMORY_PAGE_SIZE ];
+
+  while( fread( &record, sizeof( record ), 1, f ) == 1 ) {
+
+    for( i = 0; i < 4; i++ )
+      scratch[ (libspectrum_word)( record.pc + i ) ] = record.opcode[i];
+
+    debugger_disassemble( instruction, sizeof( instruction ), &length,
+                          record.pc );
+
+    printf( "%6lu %5lu %04x %s:%-3d ", (unsigned long)record.frame,
+            (unsigned long)record.tstates, record.pc,
+            memory_source_description( record.source ), record.page );
+
+    for( i = 0; i < 4; i++ ) {
+      if( i < length ) {
+        printf( "%02x", record.opcode[i] );
+      } else {
+        printf( "  " );
+      }
+    }
+
+    printf( " %-20s AF=%04x BC=%04x DE=%04x HL=%04x SP=%04x IX=%04x IY=%04x\n",
+            instruction, record.af, record.bc, record.de, record.hl,
+            record.sp, record.ix, record.iy );
+  }
+
+  fclose( f );
+
+  exit( 0 );
+}
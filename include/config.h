@@ -159,8 +159,10 @@
 /* Defined if framebuffer UI in use */
 /* #undef UI_FB */
 
-/* Defined if GTK+ UI is in use */
+/* Defined if GTK+ UI is in use; the headless tools define UI_NULL instead */
+#ifndef UI_NULL
 #define UI_GTK 1
+#endif
 
 /* Defined if the SDL UI in use */
 /* #undef UI_SDL */
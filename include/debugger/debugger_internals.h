@@ -52,6 +52,7 @@ int debugger_port_write( libspectrum_word address, libspectrum_byte value );
 int debugger_register_hash( const char *reg );
 libspectrum_word debugger_register_get( int which );
 void debugger_register_set( int which, libspectrum_word value );
+const void* debugger_register_address( int which, int *word );
 const char* debugger_register_text( int which );
 
 void debugger_exit_emulator( void );
@@ -97,6 +98,13 @@ void debugger_expression_delete( debugger_expression* expression );
 libspectrum_dword
 debugger_expression_evaluate( debugger_expression* expression );
 
+/* An expression compiled for repeated evaluation, as for breakpoint
+   conditions */
+debugger_program* debugger_expression_compile( debugger_expression *exp );
+void debugger_program_free( debugger_program *program );
+
+libspectrum_dword debugger_program_run( debugger_program *program );
+
 /* Event handling */
 
 void debugger_event_init( void );
@@ -0,0 +1,33 @@
+// Starting, leaving and going back to the embedded games, as the menu
+// does it. Shared by anthology and the headless benchmark, so that the
+// benchmark times the same game switch the menu makes.
+
+#ifndef ANTHOLOGY_GAMES_H
+#define ANTHOLOGY_GAMES_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Container for embedded game sources.
+extern std::unique_ptr<std::map<std::string, std::vector<char> > > game_sources;
+
+// Container for embedded snapshots of the games once loaded, by game.
+extern std::unique_ptr<std::map<std::string, std::vector<char> > > snapshot_sources;
+
+class Games
+{
+public :
+
+	// Put game #igame into the machine: carry on where it was left, if it
+	// is still suspended, or else start it afresh. Its history is recorded
+	// from then on, to be able to go back through it.
+	static void enter(const int igame);
+
+	// Take game #igame out of the machine, keeping it in memory to come
+	// back to if 'suspend' is set.
+	static void leave(const int igame, const bool suspend);
+};
+
+#endif // ANTHOLOGY_GAMES_H
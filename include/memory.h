@@ -172,4 +172,55 @@ void memory_display_dirty_sinclair( libspectrum_word address,
 void memory_display_dirty_pentagon_16_col( libspectrum_word address,
                                            libspectrum_byte b );
 
+/* Tracking of which 16K RAM pages have been written to. Every write to a
+   RAM page records the current epoch against that page; anything wanting
+   to know what has changed since some point starts a new epoch there with
+   memory_ram_epoch_next(), and a page has then been written to since if
+   its entry in memory_ram_written[] is at least the value returned */
+extern libspectrum_dword memory_ram_epoch;
+extern libspectrum_dword memory_ram_written[ SPECTRUM_RAM_PAGES ];
+
+libspectrum_dword memory_ram_epoch_next( void );
+
+/* Record a write to a RAM page made other than through writebyte() */
+#define memory_ram_set_written( page_num ) \
+  ( memory_ram_written[ (page_num) ] = memory_ram_epoch )
+
+/* Put the memory state into a snapshot. If 'borrow' is set, the
+   snapshot's RAM pages point at RAM itself rather than at copies of it,
+   for snapshots which are only going to be written out; they must then
+   be handed back with memory_snapshot_unborrow() before the snapshot is
+   freed */
+void memory_to_snapshot_ex( libspectrum_snap *snap, int borrow );
+
+void memory_snapshot_unborrow( libspectrum_snap *snap );
+
+/* How many 16K RAM pages the current machine has */
+size_t memory_ram_pages( void );
+
+/* A capture of the RAM pages. Pages which haven't been written to since
+   the capture a new one is based on are shared with it rather than
+   copied, so capturing the same game over and over only copies what it
+   has changed in between */
+typedef struct memory_ram_copy_t {
+  libspectrum_byte data[ 0x4000 ];
+  int refcount;
+} memory_ram_copy_t;
+
+typedef struct memory_ram_capture_t {
+  libspectrum_dword epoch;
+  memory_ram_copy_t *pages[ SPECTRUM_RAM_PAGES ];
+} memory_ram_capture_t;
+
+/* Capture the first 'pages' RAM pages, sharing what hasn't changed with
+   'base' if that isn't NULL */
+memory_ram_capture_t* memory_ram_capture( const memory_ram_capture_t *base,
+                                          size_t pages );
+
+/* Put a capture back into RAM; it can then be used as the base for the
+   next capture of the same game */
+void memory_ram_restore( memory_ram_capture_t *capture );
+
+void memory_ram_capture_free( memory_ram_capture_t *capture );
+
 #endif				/* #ifndef FUSE_MEMORY_H */
@@ -0,0 +1,89 @@
+/* perf.h: Host-side timing of the emulator's phases
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_PERF_H
+#define FUSE_PERF_H
+
+#include <stdio.h>
+
+#include <libspectrum.h>
+
+/* What the host is spending its time on. Phases nest: time in a phase
+   entered from another one counts only towards the inner one */
+typedef enum perf_phase {
+  PERF_PHASE_OTHER,		/* Anything not below, including the UI */
+  PERF_PHASE_Z80,		/* z80_do_opcodes() */
+  PERF_PHASE_EVENTS,		/* Event callbacks */
+  PERF_PHASE_DISPLAY,		/* display_frame() */
+  PERF_PHASE_SOUND,		/* sound_frame(), less the AY */
+  PERF_PHASE_AY,		/* sound_ay_overlay() */
+  PERF_PHASE_PAINT,		/* Painting the screen in the UI */
+
+  PERF_PHASES
+} perf_phase;
+
+/* Things counted per frame, reported alongside the phases */
+typedef enum perf_counter {
+  PERF_COUNTER_AY_LOG,		/* AY register writes logged for the frame */
+
+  PERF_COUNTERS
+} perf_counter;
+
+/* Where the periodic reports go */
+typedef enum perf_output {
+  PERF_OUTPUT_NONE,
+  PERF_OUTPUT_TEXT,		/* A line per phase on stderr */
+  PERF_OUTPUT_JSON,		/* A JSON object per report on stderr */
+} perf_output;
+
+extern int perf_active;
+extern libspectrum_dword perf_counts[ PERF_COUNTERS ];
+
+void perf_start( perf_output output );
+void perf_stop( void );
+
+perf_phase perf_switch( perf_phase phase );
+
+/* Start timing 'phase'; returns what to pass to perf_leave() at the end */
+static inline perf_phase
+perf_enter( perf_phase phase )
+{
+  return perf_active ? perf_switch( phase ) : PERF_PHASE_OTHER;
+}
+
+static inline void
+perf_leave( perf_phase previous )
+{
+  if( perf_active ) perf_switch( previous );
+}
+
+/* Add 'n' to this frame's count of 'counter' */
+static inline void
+perf_count( perf_counter counter, libspectrum_dword n )
+{
+  if( perf_active ) perf_counts[ counter ] += n;
+}
+
+/* Called at the end of every frame while active */
+void perf_frame( void );
+
+/* The minimum, mean and 99th percentile per-frame time of each phase over
+   the last few seconds, as text, a line per phase */
+void perf_summary( char *buffer, size_t length );
+
+#endif			/* #ifndef FUSE_PERF_H */
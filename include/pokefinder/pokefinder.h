@@ -37,4 +37,10 @@ int pokefinder_search( libspectrum_byte value );
 int pokefinder_incremented( void );
 int pokefinder_decremented( void );
 
+/* The same, for 16 bit little endian values; a location is where the low
+   byte of the value is */
+int pokefinder_search_word( libspectrum_word value );
+int pokefinder_incremented_word( void );
+int pokefinder_decremented_word( void );
+
 #endif				/* #ifndef FUSE_POKEFINDER_H */
@@ -0,0 +1,39 @@
+/* rewind.h: In-memory rewind buffer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_REWIND_H
+#define FUSE_REWIND_H
+
+#include <stdlib.h>
+
+extern int rewind_active;
+
+/* Start recording a frame of history at every frame */
+int rewind_start( void );
+
+/* Stop recording, and forget all the history */
+void rewind_stop( void );
+
+/* Called at the end of every frame while active */
+void rewind_frame( void );
+
+/* Go back to the state 'frames' frames before the last one recorded, or
+   as far back as there is history for, and forget everything since */
+int rewind_step_back( size_t frames );
+
+#endif			/* #ifndef FUSE_REWIND_H */
@@ -36,7 +36,18 @@ int snapshot_read_buffer( const unsigned char *buffer, size_t length,
 
 int snapshot_copy_from( libspectrum_snap *snap );
 
+/* As snapshot_copy_from(), but for a snapshot taken earlier from the
+   machine as it is now, which only needs its state put back: unless it
+   is for another machine, the machine isn't reset first, so the ROMs
+   aren't reloaded and the tape carries on as it was. RAM pages missing
+   from the snapshot are left as they are */
+int snapshot_copy_from_without_reset( libspectrum_snap *snap );
+
 int snapshot_write( const char *filename );
 int snapshot_copy_to( libspectrum_snap *snap );
 
+/* As snapshot_copy_to(), but with the snapshot's RAM pages borrowed from
+   RAM itself; see memory_to_snapshot_ex() */
+int snapshot_copy_to_borrowed( libspectrum_snap *snap );
+
 #endif
@@ -39,6 +39,8 @@ void sound_frame( void );
 void sound_beeper( int on );
 libspectrum_dword sound_get_effective_processor_speed( void );
 
+int sound_unittest( void );
+
 extern int sound_enabled;
 extern int sound_framesiz;
 
@@ -105,6 +105,15 @@ void blip_buffer_end_frame( Blip_Buffer * buff, blip_time_t time );
 long blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * dest,
                                long max_samples, int stereo );
 
+/*  Read at most 'max_samples' out of both 'left' and 'right' into 'dest',
+ interleaved as left, right, left, right... Gives the same samples as reading
+ 'left' into the even samples and then 'right' into the odd ones, but does
+ both channels in one pass. Returns number of samples read from each buffer.
+*/
+long blip_buffer_read_samples_stereo( Blip_Buffer * left, Blip_Buffer * right,
+                                      blip_sample_t * dest,
+                                      long max_samples );
+
 /*  Additional optional features */
 
 /*  Set frequency high-pass filter frequency, where higher values reduce bass more */
@@ -185,6 +194,11 @@ typedef short imp_t;
 typedef struct Blip_Synth_s {
   imp_t *impulses;
   Blip_Synth_ impl;
+
+  /* The impulses again, BLIP_SYNTH_QUALITY for each phase in the order they
+     are added into the buffer, for the vector versions of
+     blip_synth_offset_resampled() */
+  imp_t *kernels;
 } Blip_Synth;
 
 void blip_synth_set_volume( Blip_Synth * synth, double v );
@@ -207,6 +221,25 @@ void blip_synth_offset_resampled( Blip_Synth * synth,
                                  Blip_Buffer * buff );
 Blip_Synth *new_Blip_Synth( void );
 
+/*  Which version of blip_synth_offset_resampled() is used. The vector
+ versions give exactly the same results as the plain C one. */
+typedef enum blip_simd_t {
+  BLIP_SIMD_NONE,
+  BLIP_SIMD_SSE41,
+  BLIP_SIMD_AVX2,
+  BLIP_SIMD_NEON,
+
+  BLIP_SIMD_COUNT
+} blip_simd_t;
+
+/*  The fastest version this machine can run; used unless another is picked */
+blip_simd_t blip_simd_best( void );
+
+/*  Use 'simd' from now on. Returns non-zero if this machine can't run it */
+int blip_simd_select( blip_simd_t simd );
+
+const char *blip_simd_name( blip_simd_t simd );
+
 void delete_Blip_Synth( Blip_Synth ** synth );
 
 #define BLIP_EQ_DEF_CUTOFF 0
@@ -30,6 +30,11 @@
  *	would result in memory thrashing. (Amazing that
  *	I've manage to use this to the extent I have
  *	without running into this... *heh*)
+ *
+ * Fuse: positions are C11 atomics, free running rather than
+ *	wrapped, so the whole buffer can be used; each is
+ *	kept on its own cache line, as each is written by
+ *	a different thread.
  */
 
 #ifndef	_SFIFO_H_
@@ -40,30 +45,32 @@ extern "C" {
 #endif
 
 #include <errno.h>
+#include <stdatomic.h>
 
 /*------------------------------------------------
 	"Private" stuff
 ------------------------------------------------*/
 /*
- * Porting note:
- *	Reads and writes of a variable of this type in memory
- *	must be *atomic*! 'int' is *not* atomic on all platforms.
- *	A safe type should be used, and  sfifo should limit the
- *	maximum buffer size accordingly.
+ * One thread may write to a FIFO while another reads
+ * from it. Positions only ever increase, and wrap at
+ * 2^32; the number of bytes in the FIFO is the
+ * difference between them.
  */
-typedef int sfifo_atomic_t;
-#ifdef __TURBOC__
-#	define	SFIFO_MAX_BUFFER_SIZE	0x7fff
-#else /* Kludge: Assume 32 bit platform */
-#	define	SFIFO_MAX_BUFFER_SIZE	0x7fffffff
-#endif
+typedef atomic_uint sfifo_atomic_t;
+#define	SFIFO_MAX_BUFFER_SIZE	0x7fffffff
+
+#define	SFIFO_CACHE_LINE	64
 
 typedef struct sfifo_t
 {
 	char *buffer;
-	int size;			/* Number of bytes */
-	sfifo_atomic_t readpos;		/* Read position */
-	sfifo_atomic_t writepos;	/* Write position */
+	unsigned int size;		/* Number of bytes, a power of 2 */
+
+	/* Only ever written by the reader */
+	_Alignas(SFIFO_CACHE_LINE) sfifo_atomic_t readpos;
+
+	/* Only ever written by the writer */
+	_Alignas(SFIFO_CACHE_LINE) sfifo_atomic_t writepos;
 } sfifo_t;
 
 #define SFIFO_SIZEMASK(x)	((x)->size - 1)
@@ -77,8 +84,22 @@ void sfifo_close(sfifo_t *f);
 void sfifo_flush(sfifo_t *f);
 int sfifo_write(sfifo_t *f, const void *buf, int len);
 int sfifo_read(sfifo_t *f, void *buf, int len);
-#define sfifo_used(x)	(((x)->writepos - (x)->readpos) & SFIFO_SIZEMASK(x))
-#define sfifo_space(x)	((x)->size - 1 - sfifo_used(x))
+
+/* Either side may call these, but the answer may be out of date by the
+   time it is used: only ever by less used for the reader, and by less
+   space for the writer */
+static inline int
+sfifo_used(sfifo_t *f)
+{
+	return atomic_load_explicit(&f->writepos, memory_order_acquire) -
+		atomic_load_explicit(&f->readpos, memory_order_acquire);
+}
+
+static inline int
+sfifo_space(sfifo_t *f)
+{
+	return f->size - sfifo_used(f);
+}
 
 
 /*------------------------------------------------
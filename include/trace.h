@@ -0,0 +1,77 @@
+/* trace.h: Binary execution trace recorder
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_TRACE_H
+#define FUSE_TRACE_H
+
+#include <libspectrum.h>
+
+/* A trace file is a trace_header followed by one trace_record per
+   instruction, both in the byte order of the machine which wrote it */
+
+#define TRACE_MAGIC "ZXTR"
+#define TRACE_VERSION 1
+
+/* Written as 0x01020304 so readers can tell if the byte order differs */
+#define TRACE_BYTE_ORDER 0x01020304
+
+typedef struct trace_header {
+  char magic[4];
+  libspectrum_word version;
+  libspectrum_word record_size;
+  libspectrum_dword byte_order;
+  libspectrum_dword reserved;
+} trace_header;
+
+typedef struct trace_record {
+
+  /* When the instruction started: frames since tracing started, and
+     tstates into that frame */
+  libspectrum_dword frame;
+  libspectrum_dword tstates;
+
+  libspectrum_word pc, af, bc, de, hl, sp, ix, iy;
+
+  /* The four bytes from PC on; the instruction is the first one to four */
+  libspectrum_byte opcode[4];
+
+  /* What was paged in at PC, as in memory_map_read[] */
+  libspectrum_byte source, page;
+
+  libspectrum_byte reserved[2];
+
+} trace_record;
+
+/* Where traces go when started from the debugger with 'set $trace 1' */
+#define TRACE_DEFAULT_FILE "fuse-trace.bin"
+
+extern int trace_active;
+
+/* Start writing a trace of every instruction run to 'filename' */
+int trace_start( const char *filename );
+
+/* Stop tracing and finish writing the trace */
+void trace_stop( void );
+
+/* Called before every instruction while active */
+void trace_instruction( void );
+
+/* Called at the end of every frame while active */
+void trace_frame( void );
+
+#endif			/* #ifndef FUSE_TRACE_H */
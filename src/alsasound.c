@@ -19,6 +19,19 @@
 
 */
 
+/* The emulator writes each frame's sound into a FIFO and carries on; a
+   playback thread takes it out a period at a time and does the blocking
+   writes to ALSA. If the FIFO runs dry, the thread plays the last sample
+   again rather than let the device underrun; if it fills up, the newest
+   sound is dropped. Neither ever holds up emulation.
+
+   Device options, separated by commas, as well as the device name:
+     buffer=<frames>   ALSA buffer size
+     frames=<n>        number of periods in the buffer
+     period=<frames>   ALSA period size, and how much is written at once
+     avail=<frames>    ALSA avail_min
+     verbose           report xruns and latency every few seconds */
+
 #include <config.h>
 
 /* This is necessary to prevent warnings from the calls to
@@ -37,10 +50,12 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 
-#if 0
+#ifdef HAVE_ALSA
 #include <alsa/asoundlib.h>
+#include <glib.h>
 #endif
 
+#include "machine.h"
 #include "settings.h"
 #include "sfifo.h"
 #include "sound.h"
@@ -50,35 +65,153 @@
 /* Number of Spectrum frames audio latency to use */
 #define NUM_FRAMES 3
 
-#if 0
+/* Seconds between reports when verbose */
+#define REPORT_SECONDS 5
+
+#ifdef HAVE_ALSA
 static snd_pcm_t *pcm_handle;
 static snd_pcm_stream_t stream = SND_PCM_STREAM_PLAYBACK;
 static snd_pcm_uframes_t exact_periodsize, exact_bsize;
 static snd_output_t *output = NULL;
-#endif
+
+/* Sound on its way from the emulator to the playback thread */
+static sfifo_t sound_fifo;
+
+static GThread *playback;
+static atomic_int playing;
+
+/* Written by the playback thread only, and read once it's stopped */
+static struct {
+  unsigned long xruns;		/* The device ran dry anyway */
+  unsigned long starved;	/* Periods the FIFO couldn't fill */
+  unsigned long periods;
+  double latency_total;		/* Milliseconds, summed over 'periods' */
+  double latency_max;
+} stats;
+
+/* Written by the emulator only: frames with no room in the FIFO */
+static atomic_ulong dropped;
+#endif			/* #ifdef HAVE_ALSA */
+
 static int ch, framesize;
 static const char *pcm_name = NULL;
 static int verb = 0;
 
+#ifdef HAVE_ALSA
+
+static void
+report( void )
+{
+  fprintf( stderr, "ALSA: %lu xruns, %lu short periods, %lu frames dropped; "
+           "latency %.1f ms mean, %.1f ms max\n", stats.xruns, stats.starved,
+           atomic_load_explicit( &dropped, memory_order_relaxed ),
+           stats.periods ? stats.latency_total / stats.periods : 0.0,
+           stats.latency_max );
+}
+
+/* How long a sample written now would take to be heard: what's queued
+   for the device and what's waiting in the FIFO */
+static void
+measure_latency( unsigned int rate )
+{
+  snd_pcm_sframes_t delay;
+  double latency;
+
+  if( snd_pcm_delay( pcm_handle, &delay ) < 0 ) delay = 0;
+
+  latency = ( delay + sfifo_used( &sound_fifo ) / framesize ) * 1000.0 / rate;
+
+  stats.latency_total += latency;
+  if( latency > stats.latency_max ) stats.latency_max = latency;
+  stats.periods++;
+}
+
+static gpointer
+playback_thread( gpointer data )
+{
+  unsigned int rate = GPOINTER_TO_UINT( data );
+  size_t period_bytes = exact_periodsize * framesize;
+  char *period = g_malloc0( period_bytes );
+  snd_pcm_sframes_t written;
+  size_t got, frames, done, report_periods;
+  int err;
+
+  report_periods = REPORT_SECONDS * rate / exact_periodsize;
+  if( !report_periods ) report_periods = 1;
+
+  while( atomic_load( &playing ) ) {
+
+    got = sfifo_read( &sound_fifo, period, period_bytes );
+
+    /* Hold the last frame, rather than drop to zero and click */
+    if( got < period_bytes ) {
+      if( got >= (size_t)framesize ) {
+        for( done = got; done < period_bytes; done += framesize )
+          memcpy( period + done, period + got - framesize, framesize );
+      } else if( got ) {
+        memset( period + got, 0, period_bytes - got );
+      } else {
+        memcpy( period, period + period_bytes - framesize, framesize );
+        for( done = framesize; done < period_bytes; done += framesize )
+          memcpy( period + done, period, framesize );
+      }
+      stats.starved++;
+    }
+
+    for( done = 0, frames = exact_periodsize; done < frames; ) {
+      written = snd_pcm_writei( pcm_handle, period + done * framesize,
+                                frames - done );
+      if( written >= 0 ) { done += written; continue; }
+
+      if( written == -EPIPE ) stats.xruns++;
+      err = snd_pcm_recover( pcm_handle, written, 1 );
+      if( err < 0 ) {
+        fprintf( stderr, "ALSA: couldn't recover: %s\n", snd_strerror( err ) );
+        atomic_store( &playing, 0 );
+        break;
+      }
+    }
+
+    measure_latency( rate );
+
+    if( verb && stats.periods % report_periods == 0 ) report();
+  }
+
+  g_free( period );
+
+  return NULL;
+}
+
+#endif			/* #ifdef HAVE_ALSA */
+
 void
 sound_lowlevel_end( void )
 {
-#if 0
+#ifdef HAVE_ALSA
+  /* The thread notices within a period */
+  atomic_store( &playing, 0 );
+  if( playback ) g_thread_join( playback );
+  playback = NULL;
+
+  if( verb || stats.xruns ) report();
+
 /* Stop PCM device and drop pending frames */
   snd_pcm_drop( pcm_handle );
   snd_pcm_close( pcm_handle );
+
+  sfifo_close( &sound_fifo );
 #endif
 }
 
 int
 sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 {
-#if 0
+#ifdef HAVE_ALSA
   unsigned int exact_rate, periods;
   unsigned int val, n;
   snd_pcm_hw_params_t *hw_params;
   snd_pcm_sw_params_t *sw_params;
-  snd_pcm_uframes_t avail_min = 0, sound_periodsize, bsize = 0;
+  snd_pcm_uframes_t avail_min = 0, sound_periodsize, bsize = 0, psize = 0;
   static int first_init = 1;
   static int init_running = 0;
   const char *option;
@@ -112,6 +245,14 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
       } else {
         nperiods = val;
       }
+    } else if( ( err = sscanf( option, " period=%i %n%c", &val, &n, &tmp ) > 0 ) &&
+		( tmp == ',' || strlen( option ) == n ) ) {
+      if( val < 1 ) {
+	fprintf( stderr, "Bad value for ALSA period size %i frames, using default\n",
+		    val );
+      } else {
+        psize = val;
+      }
     } else if( ( err = sscanf( option, " avail=%i %n%c", &val, &n, &tmp ) > 0 ) &&
 		( tmp == ',' || strlen( option ) == n ) ) {
       if( val < 1 ) {
@@ -249,7 +390,9 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     }
   }
 
-  if( bsize == 0 ) {
+  if( psize != 0 ) {
+    exact_periodsize = sound_periodsize = psize;
+  } else if( bsize == 0 ) {
     /* Adjust relative processor speed to deal with adjusting sound generation
        frequency against emulation speed (more flexible than adjusting generated
        sample rate) */
@@ -363,6 +506,26 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 
   if( first_init ) snd_output_stdio_attach(&output, stdout, 0);
 
+  /* Room for the device's buffer over again, and a few frames of the
+     emulator running ahead */
+  hz = (float)sound_get_effective_processor_speed() /
+            machine_current->timings.tstates_per_frame;
+  if( sfifo_init( &sound_fifo, ( exact_bsize + NUM_FRAMES * *freqptr / hz ) *
+                  framesize ) ) {
+    settings_current.sound = 0;
+    ui_error( UI_ERROR_ERROR, "couldn't allocate sound FIFO" );
+    snd_pcm_close( pcm_handle );
+    init_running = 0;
+    return 1;
+  }
+
+  memset( &stats, 0, sizeof( stats ) );
+  atomic_store( &dropped, 0 );
+
+  atomic_store( &playing, 1 );
+  playback = g_thread_new( "alsa", playback_thread,
+                           GUINT_TO_POINTER( exact_rate ) );
+
   first_init = 0;
   init_running = 0;
 #endif
@@ -374,28 +537,16 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 void
 sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 {
-#if 0
-  int ret = 0;
-  len /= ch;	/* now in frames */
+#ifdef HAVE_ALSA
+  int bytes = len * sizeof( *data ), written;
 
-/*	to measure sound lag :-)
-  snd_pcm_status_t *status;
-  snd_pcm_sframes_t delay;
-    
-  snd_pcm_status_alloca( &status );
-  snd_pcm_status( pcm_handle, status ); 
-  delay = snd_pcm_status_get_delay( status );
-  fprintf( stderr, "%d ", (int)delay );
-*/
+  /* Whole frames only, so the channels stay in step */
+  written = sfifo_space( &sound_fifo ) / framesize * framesize;
+  if( written > bytes ) written = bytes;
 
-  while( ( ret = snd_pcm_writei( pcm_handle, data, len ) ) != len ) {
-    if( ret < 0 ) {
-      snd_pcm_prepare( pcm_handle );
-      if( verb )
-        fprintf( stderr, "ALSA: *buffer underrun*!\n" );
-    } else {
-        len -= ret;
-    }
-  }
+  sfifo_write( &sound_fifo, data, written );
+  if( written < bytes )
+    atomic_fetch_add_explicit( &dropped, ( bytes - written ) / framesize,
+                               memory_order_relaxed );
 #endif
 }
@@ -5,6 +5,7 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <input.h>
+#include <iterator>
 #include <libspectrum.h>
 #include <map>
 #include <memory>
@@ -12,6 +13,18 @@
 #include <string>
 #include <vector>
 
+#include "games.h"
+
+extern "C"
+{
+#include "event.h"
+#include "machine.h"
+#include "perf.h"
+#include "rewind.h"
+#include "settings.h"
+#include "tape.h"
+}
+
 // on 3.12.x the _start and _end versions of these functions were renamed
 // make sure to still support the old names
 #if ! GTK_CHECK_VERSION(3,12,0)
@@ -27,9 +40,6 @@ unique_ptr<map<string, vector<char> > > music_sources;
 // Container for embedded image sources.
 unique_ptr<map<string, vector<char> > > image_sources;
 
-// Container for embedded game sources.
-unique_ptr<map<string, vector<char> > > game_sources;
-
 extern "C"
 {
 	GtkWidget *gtkui_drawing_area = NULL;
@@ -39,15 +49,27 @@ extern "C"
 
 class Music
 {
-	ALLEGRO_FILE* trackFile;
-	ALLEGRO_SAMPLE* trackSample;
-	ALLEGRO_SAMPLE_ID trackId;
-
-public :
-
-	Music()
+	// Tracks are streamed from the embedded files a few chunks at a time
+	// rather than decoded whole, and cross-faded into one another
+	static const size_t streamBuffers = 4;
+	static const unsigned int streamSamples = 2048;
+
+	static const float trackGain;
+	static const double fadeSeconds;
+	static const guint fadeInterval = 50;
+
+	ALLEGRO_AUDIO_STREAM* current;
+	ALLEGRO_AUDIO_STREAM* previous;
+	int itrack;
+	double fadeStart;
+	guint fadeSource;
+
+	// Allegro audio is set up on first use and kept for the life of the
+	// program, as the menu comes and goes with every game
+	static void init()
 	{
-		srand(time(NULL));
+		static bool initialized = false;
+		if (initialized) return;
 
 		if (!al_install_system(ALLEGRO_VERSION_INT, NULL))
 		{
@@ -67,65 +89,134 @@ public :
 			exit(-1);
 		}
 
-		if (!al_reserve_samples(1))
+		// Sets up the default mixer the streams play through
+		if (!al_reserve_samples(0))
 		{
 			fprintf(stderr, "Failed to reserve samples\n");
 			exit(-1);
 		}
 
-		if (!image_sources.get())
+		srand(time(NULL));
+
+		initialized = true;
+	}
+
+	// Start streaming track #itrack_, silent until faded in
+	ALLEGRO_AUDIO_STREAM* openTrack(const int itrack_)
+	{
+		map<string, vector<char> >::iterator i = music_sources->begin();
+		advance(i, itrack_);
+
+		const string& filename = i->first;
+		vector<char>& track = i->second;
+
+		string::size_type idx = filename.rfind('.');
+		if (idx == string::npos)
 		{
-			fprintf(stderr, "Image sources list is empty\n");
+			fprintf(stderr, "Error determining music track #%d \"%s\" ident\n", itrack_, filename.c_str());
 			exit(-1);
 		}
-		
-		int ii = 0;
-		const int itrack = rand() % music_sources->size();
-		for (map<string, vector<char> >::iterator i = music_sources->begin(), e = music_sources->end(); i != e; i++)
+
+		string ext = filename.substr(idx);
+
+		ALLEGRO_FILE* file = al_open_memfile(&track[0], track.size(), "rb");
+		if (!file)
 		{
-			if (ii != itrack)
-			{
-				ii++;
-				continue;
-			}
-			
-			const string& filename = i->first;
-			vector<char>& track = i->second;
+			fprintf(stderr, "Error reading music track #%d \"%s\"\n", itrack_, filename.c_str());
+			exit(-1);
+		}
 
-			trackFile = al_open_memfile(&track[0], track.size(), "rb");
-			if (!trackFile)
-			{
-				fprintf(stderr, "Error reading music track #%d \"%s\"\n", itrack, filename.c_str());
-				exit(-1);
-			}
+		// The stream closes the file when it is destroyed
+		ALLEGRO_AUDIO_STREAM* stream = al_load_audio_stream_f(file, ext.c_str(), streamBuffers, streamSamples);
+		if (!stream)
+		{
+			fprintf(stderr, "Error decoding music track #%d \"%s\"\n", itrack_, filename.c_str());
+			al_fclose(file);
+			exit(-1);
+		}
 
-			string::size_type idx = filename.rfind('.');
-			
-			if (idx == string::npos)
+		al_set_audio_stream_playmode(stream, ALLEGRO_PLAYMODE_ONCE);
+		al_set_audio_stream_gain(stream, 0.0);
+		al_attach_audio_stream_to_mixer(stream, al_get_default_mixer());
+
+		return stream;
+	}
+
+	// Fade from whatever is playing into a random track, a different one
+	// from the last if there is a choice
+	void next()
+	{
+		const int ntracks = music_sources->size();
+		int inext = rand() % ntracks;
+		if (ntracks > 1 && inext == itrack)
+			inext = (inext + 1 + rand() % (ntracks - 1)) % ntracks;
+
+		if (previous) al_destroy_audio_stream(previous);
+		previous = current;
+
+		itrack = inext;
+		current = openTrack(itrack);
+		fadeStart = al_get_time();
+	}
+
+	static gboolean fade(gpointer user_data)
+	{
+		Music* music = (Music*)user_data;
+
+		double t = (al_get_time() - music->fadeStart) / fadeSeconds;
+		if (t > 1.0) t = 1.0;
+
+		al_set_audio_stream_gain(music->current, trackGain * t);
+		if (music->previous)
+		{
+			al_set_audio_stream_gain(music->previous, trackGain * (1.0 - t));
+			if (t == 1.0)
 			{
-				fprintf(stderr, "Error determining music track #%d \"%s\" ident\n", itrack, filename.c_str());
-				exit(-1);
+				al_destroy_audio_stream(music->previous);
+				music->previous = NULL;
 			}
+		}
 
-			string ext = filename.substr(idx);
-			
-			trackSample = al_load_sample_f(trackFile, ext.c_str());
-			
-			break;
+		// Start on the next track in time for it to be fully in as this
+		// one ends, or straight away if the end couldn't be told in advance
+		double length = al_get_audio_stream_length_secs(music->current);
+		double position = al_get_audio_stream_position_secs(music->current);
+		if (t == 1.0 && (!al_get_audio_stream_playing(music->current) ||
+			(length > 2 * fadeSeconds && position >= length - fadeSeconds)))
+			music->next();
+
+		return TRUE;
+	}
+
+public :
+
+	Music() : current(NULL), previous(NULL), itrack(-1)
+	{
+		if (!music_sources.get() || music_sources->empty())
+		{
+			fprintf(stderr, "Music sources list is empty\n");
+			exit(-1);
 		}
-	
-		al_play_sample(trackSample, 2.0, 0.0, 1.0, ALLEGRO_PLAYMODE_LOOP, &trackId);
+
+		init();
+
+		next();
+
+		fadeSource = g_timeout_add(fadeInterval, fade, this);
 	}
 	
 	~Music()
 	{
-		al_stop_sample(&trackId);
-		al_destroy_sample(trackSample);
-		al_fclose(trackFile);
-		al_uninstall_system();
+		g_source_remove(fadeSource);
+		if (previous) al_destroy_audio_stream(previous);
+		al_destroy_audio_stream(current);
 	}
 };
 
+const float Music::trackGain = 2.0;
+
+const double Music::fadeSeconds = 2.0;
+
 unique_ptr<Music> music = NULL;
 
 static cairo_status_t
@@ -147,10 +238,114 @@ stdio_read_func (void *closure, unsigned char *data, unsigned int size)
     return CAIRO_STATUS_SUCCESS;
 }
 
+// Menu screenshot, decoded once and then scaled only when the size it is
+// shown at changes
+class Thumbnail
+{
+	cairo_surface_t *image;
+	cairo_surface_t *scaled;
+
+	static cairo_surface_t* load(const int iimage)
+	{
+		if (!image_sources.get())
+		{
+			fprintf(stderr, "Image sources list is empty\n");
+			exit(-1);
+		}
+
+		int ii = 0;
+		for (map<string, vector<char> >::iterator i = image_sources->begin(), e = image_sources->end(); i != e; i++)
+		{
+			if (ii != iimage)
+			{
+				ii++;
+				continue;
+			}
+
+			const string& filename = i->first;
+			vector<char>& image = i->second;
+			if (!&image[0])
+			{
+				fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
+				exit(-1);
+			}
+			FILE* imageFile = fmemopen(&image[0], image.size(), "rb");
+			if (!imageFile)
+			{
+				fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
+				exit(-1);
+			}
+			cairo_surface_t *img = cairo_image_surface_create_from_png_stream(stdio_read_func, imageFile);
+			fclose(imageFile);
+			if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS)
+			{
+				fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
+				exit(-1);
+			}
+
+			return img;
+		}
+
+		fprintf(stderr, "No image #%d\n", iimage);
+		exit(-1);
+	}
+
+public :
+
+	Thumbnail() : image(NULL), scaled(NULL) { }
+
+	~Thumbnail()
+	{
+		if (scaled) cairo_surface_destroy(scaled);
+		if (image) cairo_surface_destroy(image);
+	}
+
+	// Image #iimage at width x height
+	cairo_surface_t* get(const int iimage, int width, int height)
+	{
+		if (!image) image = load(iimage);
+
+		width = MAX(width, 1);
+		height = MAX(height, 1);
+
+		if (scaled && (cairo_image_surface_get_width(scaled) == width) &&
+			(cairo_image_surface_get_height(scaled) == height))
+			return scaled;
+
+		if (scaled) cairo_surface_destroy(scaled);
+		scaled = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+
+		cairo_t *cr = cairo_create(scaled);
+		cairo_scale(cr, (double)width / cairo_image_surface_get_width(image),
+			(double)height / cairo_image_surface_get_height(image));
+		cairo_set_source_surface(cr, image, 0, 0);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+
+		return scaled;
+	}
+};
+
+static void ui_joystick_poll();
+
 class Menu
 {
 	GtkWidget *window;
 
+	// Joystick buttons drive the menu too, but SDL gives us nothing to
+	// wait on, so poll it from a low-rate timer while the menu is shown
+	guint joystickSource;
+
+	static const guint joystick_poll_interval = 30;
+
+	static gboolean joystick_poll(gpointer user_data)
+	{
+		ui_joystick_poll();
+
+		return TRUE;
+	}
+
 	static int indexes[3];
 	static const char* screens[3];
 
@@ -160,89 +355,35 @@ class Menu
 	GtkWidget *gamePool;
 	GtkWidget *gameEmpty;
 
-	static void draw(GtkWidget *widget, const int iimage, gboolean frame)
-	{
-		{
-			cairo_t *cr = gdk_cairo_create(gtk_widget_get_window(GTK_WIDGET(widget)));
+	// Decoded screenshots, kept for as long as the program runs so that
+	// coming back to the menu doesn't decode them again
+	static Thumbnail thumbnails[3];
 
-			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-
-			int width = gtk_widget_get_allocated_width(widget);
-			int height = gtk_widget_get_allocated_height(widget);
+	static void draw(GtkWidget *widget, cairo_t *cr, const int iimage, gboolean frame)
+	{
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 
-			if (!image_sources.get())
-			{
-				fprintf(stderr, "Image sources list is empty\n");
-				exit(-1);
-			}
+		int width = gtk_widget_get_allocated_width(widget);
+		int height = gtk_widget_get_allocated_height(widget);
 
-			// Load image and get dimensions.
-			int ii = 0;
-			for (map<string, vector<char> >::iterator i = image_sources->begin(), e = image_sources->end(); i != e; i++)
-			{
-				if (ii != iimage)
-				{
-					ii++;
-					continue;
-				}
-			
-				const string& filename = i->first;
-				vector<char>& image = i->second;
-				if (!&image[0])
-				{
-					fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
-					exit(-1);
-				}
-				FILE* imageFile = fmemopen(&image[0], image.size(), "rb");
-				if (!imageFile)
-				{
-					fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
-					exit(-1);
-				}
-				cairo_surface_t *img = cairo_image_surface_create_from_png_stream(stdio_read_func, imageFile);
-				if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS)
-				{
-					fprintf(stderr, "Failed to load image \"%s\"\n", filename.c_str());
-					exit(-1);
-				}
-				int imgw = cairo_image_surface_get_width(img);
-				int imgh = cairo_image_surface_get_height(img);
-
-				float scaleX = (float)(width - 20) / imgw;
-				float scaleY = (float)(height - 20) / imgh;
-				cairo_scale(cr, scaleX, scaleY);
-				cairo_set_source_surface(cr, img, 10 / scaleX, 10 / scaleY);
-				cairo_paint(cr);
-
-				cairo_destroy(cr);
-				
-				break;
-			}
-		}
+		cairo_surface_t *img = thumbnails[iimage].get(iimage, width - 20, height - 20);
+		cairo_set_source_surface(cr, img, 10, 10);
+		cairo_paint(cr);
 
 		if (frame)
 		{
-			cairo_t *cr = gdk_cairo_create(gtk_widget_get_window(GTK_WIDGET(widget)));
-
-			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-
-			size_t width = gtk_widget_get_allocated_width(widget);
-			size_t height = gtk_widget_get_allocated_height(widget);
-
 			cairo_set_source_rgb(cr, 0.9, 0.9, 0);
 			cairo_set_line_width(cr, 10);
 			cairo_rectangle(cr, 5, 5, width - 10, height - 10);
 			cairo_stroke(cr);
-
-			cairo_destroy(cr);
 		}
 	}
 
-	static gboolean on_draw_event(GtkWidget *widget, GdkEventExpose *event, gpointer user_data)
+	static gboolean on_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
 	{
 		int i = *(int*)user_data;
 
-		draw(widget, i, selected_game == i);
+		draw(widget, cr, i, selected_game == i);
 
 		return FALSE;
 	}
@@ -283,16 +424,21 @@ public :
 		gtk_grid_attach(GTK_GRID(grid), gameEmpty, 0, 1, 3, 1);
 
 		gtk_container_add(GTK_CONTAINER(window), grid);
+
+		joystickSource = g_timeout_add(joystick_poll_interval, joystick_poll, NULL);
 	}
 	
 	~Menu()
 	{
+		g_source_remove(joystickSource);
 		gtk_container_remove(GTK_CONTAINER(window), grid);
 	}
 };
 
 int Menu::indexes[3] = { 0, 1, 2 };
 
+Thumbnail Menu::thumbnails[3];
+
 const char* Menu::screens[3] =
 {
 	"games/3dmoto/3dmoto.png",
@@ -304,22 +450,17 @@ unique_ptr<Menu> menu = NULL;
 
 extern "C" int machine_init();
 extern "C" void z80_do_opcodes();
-extern "C" int event_do_events();
-extern "C" int tape_read_buffer(unsigned char *buffer, size_t length,
-	libspectrum_id_t type, const char *filename, int autoload);
 extern "C" int gtkkeyboard_keypress(GtkWidget *widget, GdkEvent *event, gpointer data);
 extern "C" int gtkkeyboard_keyrelease(GtkWidget *widget, GdkEvent *event, gpointer data);
 
-#define DISPLAY_SCREEN_WIDTH 320
-#define DISPLAY_SCREEN_HEIGHT 240
-
 extern "C"
 {
 	int fuse_exiting;
 	extern int stop_event;
 
-	// A copy of every pixel on the screen
-	extern libspectrum_word gtkdisplay_image[2 * DISPLAY_SCREEN_HEIGHT][DISPLAY_SCREEN_WIDTH];
+	// Every pixel on the screen, in xRGB32 format, at twice the normal
+	// width and height so hires modes fit
+	extern libspectrum_dword gtkdisplay_image[2 * DISPLAY_SCREEN_HEIGHT][DISPLAY_SCREEN_WIDTH];
 }
 
 class ZX80
@@ -327,129 +468,199 @@ class ZX80
 	GtkWidget *window;
 	GtkWidget** gtkui_drawing_area;
 
-	vector<uint32_t> pixels;
-	int stride;
-	
+	// Index of the game running
+	int game;
+
+	// Wrap gtkdisplay_image, which the core plots straight into: the
+	// normal 320x240 part of it, and all 640x480 of it for a Timex
 	cairo_surface_t *surface;
+	cairo_surface_t *timexSurface;
 
-	uint32_t palette[16];
+	// The Spectrum keyboard is on the window only while a game runs
+	gulong keyPressId;
+	gulong keyReleaseId;
 
-	// Called by gtkui_drawing_area on "draw" event
-	static gboolean gtkdisplay_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+	// Emulation runs from the drawing area's frame clock
+	guint tickId;
+
+	// Frame clock time emulation was last (re)started at, and the number
+	// of Spectrum frames run since then
+	gint64 clockStart;
+	gint64 framesRun;
+
+	// Run the Spectrum up to the end of its current frame
+	static void runFrame()
+	{
+		while (1)
+		{
+			z80_do_opcodes();
+
+			// The end of frame event winds the clock back by a frame
+			libspectrum_dword at_event = tstates;
+			event_do_events();
+			if (tstates < at_event) break;
+		}
+	}
+
+	// Called by the frame clock before each repaint: runs however many
+	// Spectrum frames are due by now, so emulation is paced by the display
+	// and the main loop sleeps in between
+	static gboolean tick(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
 	{
 		ZX80& zx80 = *(ZX80*)user_data;
-	
-		size_t width = gtk_widget_get_allocated_width(widget);
-		size_t height = gtk_widget_get_allocated_height(widget);
 
-		if (zx80.pixels.size() != width * height)
-		{
-			zx80.pixels.resize(width * height);
-	
-			// Create a new surface, if size has changed.
-			if (zx80.surface) cairo_surface_destroy(zx80.surface);
+		gint64 now = gdk_frame_clock_get_frame_time(clock);
 
-			zx80.stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, DISPLAY_SCREEN_WIDTH);
+		// When fastloading, spend most of each tick running flat out,
+		// as timer_frame() would, and pick up real time afterwards
+		if (settings_current.fastload && tape_is_playing())
+		{
+			gint64 end = g_get_monotonic_time() + fastload_slice;
+			while (is_game_active && tape_is_playing() && g_get_monotonic_time() < end)
+				runFrame();
 
-			zx80.surface = cairo_image_surface_create_for_data((unsigned char*)&zx80.pixels[0], CAIRO_FORMAT_RGB24,
-				DISPLAY_SCREEN_WIDTH, DISPLAY_SCREEN_HEIGHT, zx80.stride);
+			zx80.clockStart = -1;
+			return TRUE;
 		}
-		
-		// Copy from gtkdisplay_image, converting the format
-		for (int yy = 0; yy < DISPLAY_SCREEN_HEIGHT; yy++)
-		{
-			uint32_t *rgb24 = (uint32_t*)((char*)&zx80.pixels[0] + yy * zx80.stride);
 
-			libspectrum_word *display = &gtkdisplay_image[yy * 2][0];
+		float speed = (settings_current.emulation_speed < 1 ?
+			1.0 : settings_current.emulation_speed) / 100.0;
+		double rate = speed * machine_current->timings.processor_speed /
+			machine_current->timings.tstates_per_frame;
+
+		gint64 due = (now - zx80.clockStart) * rate / G_USEC_PER_SEC;
 
-			for (int i = 0; i < DISPLAY_SCREEN_WIDTH; i++)
-				rgb24[i] = zx80.palette[display[i]];
+		// Start afresh rather than race to catch up, after a stall such as
+		// the window being hidden
+		if (zx80.clockStart < 0 || due - zx80.framesRun > max_frames_per_tick)
+		{
+			zx80.clockStart = now;
+			zx80.framesRun = 0;
+			due = 1;
 		}
 
+		for ( ; zx80.framesRun < due && is_game_active; zx80.framesRun++)
+			runFrame();
+
+		// The core only invalidates what it has changed; the frame timing
+		// overlay changes every frame
+		if (perf_active)
+			gtk_widget_queue_draw_area(widget, 0, 0, perfWidth, perfHeight);
+
+		return TRUE;
+	}
+
+	// Called by gtkui_drawing_area on "draw" event
+	static gboolean gtkdisplay_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+	{
+		ZX80& zx80 = *(ZX80*)user_data;
+
+		perf_phase previous = perf_enter(PERF_PHASE_PAINT);
+	
+		size_t width = gtk_widget_get_allocated_width(widget);
+		size_t height = gtk_widget_get_allocated_height(widget);
+
+		// A Timex draws every pixel doubled, so show all of the image
+		cairo_surface_t *surface = machine_current->timex ? zx80.timexSurface : zx80.surface;
+
+		// The core has written to the image behind cairo's back
+		cairo_surface_mark_dirty(surface);
+
+		cairo_save(cr);
 		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 
-		float scaleX = (float)width / DISPLAY_SCREEN_WIDTH;
-		float scaleY = (float)height / DISPLAY_SCREEN_HEIGHT;
+		float scaleX = (float)width / cairo_image_surface_get_width(surface);
+		float scaleY = (float)height / cairo_image_surface_get_height(surface);
 		cairo_scale(cr, scaleX, scaleY);
 
-		// Repaint the drawing area
-		cairo_set_source_surface(cr, zx80.surface, 0, 0);
+		// Repaint the drawing area. GTK has clipped cr to the areas
+		// invalidated by uidisplay_area(), so only those get rescaled.
+		cairo_set_source_surface(cr, surface, 0, 0);
 		cairo_paint(cr);
+		cairo_restore(cr);
+
+		if (perf_active) drawPerf(cr);
+
+		perf_leave(previous);
 
 		return FALSE;
 	}
 
-	static void initPalette(libspectrum_dword* palette)
+	// Size of the frame timing overlay, in pixels
+	static const int perfWidth = 260;
+	static const int perfHeight = 120;
+
+	// Overlay the per-phase frame times in the top left corner
+	static void drawPerf(cairo_t *cr)
 	{
-		for (int i = 0; i < 16; i++)
-		{
-			guchar red, green, blue;
+		char summary[512];
+		perf_summary(summary, sizeof(summary));
 
-			red   = rgbColors[i][0];
-			green = rgbColors[i][1];
-			blue  = rgbColors[i][2];
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+		cairo_rectangle(cr, 0, 0, perfWidth, perfHeight);
+		cairo_fill(cr);
 
-#ifdef WORDS_BIGENDIAN
-			palette[i] = blue << 24 | green << 16 |  red << 8;
-#else
-			palette[i] = blue | green << 8 |  red << 16;
-#endif // WORDS_BIGENDIAN
+		cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+		cairo_set_font_size(cr, 12);
+		cairo_set_source_rgb(cr, 1, 1, 1);
+
+		double y = 14;
+		cairo_move_to(cr, 5, y);
+		cairo_show_text(cr, "phase      min    avg    p99 us");
+
+		for (char *line = strtok(summary, "\n"); line; line = strtok(NULL, "\n"))
+		{
+			y += 14;
+			cairo_move_to(cr, 5, y);
+			cairo_show_text(cr, line);
 		}
 	}
-	
-	// The color palette
-	static const guchar rgbColors[16][3];
+
+	// Most Spectrum frames to run in one tick before giving up on keeping
+	// up with real time
+	static const int max_frames_per_tick = 4;
+
+	// Microseconds of each tick spent fastloading
+	static const gint64 fastload_slice = 12000;
 
 public :
 
 	ZX80(GtkWidget *window_, GtkWidget** gtkui_drawing_area_) :
-		window(window_), gtkui_drawing_area(gtkui_drawing_area_),
-		pixels(0), surface(NULL)
+		window(window_), gtkui_drawing_area(gtkui_drawing_area_), game(selected_game),
+		clockStart(-1), framesRun(0)
 	{
-		initPalette((libspectrum_dword*)palette);
-	
+		surface = cairo_image_surface_create_for_data((unsigned char*)&gtkdisplay_image[0][0],
+			CAIRO_FORMAT_RGB24, DISPLAY_ASPECT_WIDTH, DISPLAY_SCREEN_HEIGHT, sizeof(gtkdisplay_image[0]));
+		timexSurface = cairo_image_surface_create_for_data((unsigned char*)&gtkdisplay_image[0][0],
+			CAIRO_FORMAT_RGB24, DISPLAY_SCREEN_WIDTH, 2 * DISPLAY_SCREEN_HEIGHT, sizeof(gtkdisplay_image[0]));
+
 		*gtkui_drawing_area = gtk_drawing_area_new();
 
 		g_signal_connect(G_OBJECT(*gtkui_drawing_area), "draw", G_CALLBACK(gtkdisplay_draw), this);
-		g_signal_connect(G_OBJECT(window), "key-press-event", G_CALLBACK(gtkkeyboard_keypress), NULL);
+		keyPressId = g_signal_connect(G_OBJECT(window), "key-press-event", G_CALLBACK(gtkkeyboard_keypress), NULL);
 		gtk_widget_add_events(window, GDK_KEY_RELEASE_MASK );
-		g_signal_connect(G_OBJECT(window), "key-release-event", G_CALLBACK(gtkkeyboard_keyrelease), NULL);
+		keyReleaseId = g_signal_connect(G_OBJECT(window), "key-release-event", G_CALLBACK(gtkkeyboard_keyrelease), NULL);
 
 		gtk_container_add(GTK_CONTAINER(window), *gtkui_drawing_area);
 
-		machine_init();
-
-		if (!game_sources.get())
-		{
-			fprintf(stderr, "Game sources list is empty\n");
-			exit(-1);
-		}
-
-		int ii = 0;
-		for (map<string, vector<char> >::iterator i = game_sources->begin(), e = game_sources->end(); i != e; i++)
-		{
-			if (ii != selected_game)
-			{
-				ii++;
-				continue;
-			}
-
-			const string& filename = i->first;
-			vector<char>& game = i->second;
+		Games::enter(game);
 
-			int error = tape_read_buffer((unsigned char*)&game[0], game.size(), LIBSPECTRUM_ID_TAPE_TZX, filename.c_str(), TRUE);
-			if (error)
-			{
-				fprintf(stderr, "Error loading game \"%s\": errno = %d\n", filename.c_str(), error);
-				exit(-1);
-			}
-			break;
-		}
+		tickId = gtk_widget_add_tick_callback(*gtkui_drawing_area, tick, this, NULL);
 	}
 	
 	~ZX80()
 	{
+		// Keep the game in memory to come back to, unless we're quitting
+		Games::leave(game, !fuse_exiting);
+
+		gtk_widget_remove_tick_callback(*gtkui_drawing_area, tickId);
+		g_signal_handler_disconnect(window, keyPressId);
+		g_signal_handler_disconnect(window, keyReleaseId);
 		gtk_container_remove(GTK_CONTAINER(window), *gtkui_drawing_area);
+		*gtkui_drawing_area = NULL;
+		cairo_surface_destroy(timexSurface);
+		cairo_surface_destroy(surface);
 	}
 };
 
@@ -503,26 +714,6 @@ extern "C"
 	};
 }
 
-const guchar ZX80::rgbColors[16][3] =
-{
-	{   0,   0,   0 },
-	{   0,   0, 192 },
-	{ 192,   0,   0 },
-	{ 192,   0, 192 },
-	{   0, 192,   0 },
-	{   0, 192, 192 },
-	{ 192, 192,   0 },
-	{ 192, 192, 192 },
-	{   0,   0,   0 },
-	{   0,   0, 255 },
-	{ 255,   0,   0 },
-	{ 255,   0, 255 },
-	{   0, 255,   0 },
-	{   0, 255, 255 },
-	{ 255, 255,   0 },
-	{ 255, 255, 255 },
-};
-
 unique_ptr<ZX80> zx80 = NULL;
 
 static gboolean delete_event(GtkWidget *widget, GdkEvent *event, gpointer data)
@@ -530,12 +721,23 @@ static gboolean delete_event(GtkWidget *widget, GdkEvent *event, gpointer data)
 	return FALSE;
 }
 
+static void quit()
+{
+	if (fuse_exiting) return;
+
+	fuse_exiting = 1;
+	gtk_main_quit();
+}
+
 /* Another callback */
 static void destroy(GtkWidget *widget, gpointer data)
 {
-	fuse_exiting = 1;
+	quit();
 }
 
+// Frames to go back by for each press of the rewind key
+static const size_t rewind_step_frames = 5;
+
 static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 {
 	if (!is_game_active)
@@ -555,7 +757,7 @@ static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer use
 			gtk_widget_queue_draw(widget);
 			break;
 		case GDK_KEY_Escape :
-			fuse_exiting = 1;
+			quit();
 		}
 	}
 	else
@@ -567,6 +769,19 @@ static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer use
 			stop_event = -1;
 			gtk_widget_queue_draw(widget);
 			break;
+		case GDK_KEY_F11 :
+			// Holding it down goes back in time, with the key's
+			// autorepeat
+			rewind_step_back(rewind_step_frames);
+			return TRUE;
+		case GDK_KEY_F12 :
+			// Show or hide the frame timing overlay
+			if (perf_active)
+				perf_stop();
+			else
+				perf_start(PERF_OUTPUT_NONE);
+			gtk_widget_queue_draw(widget);
+			return TRUE;
 		}
 	}
 
@@ -631,7 +846,7 @@ static void joystick_button_action(SDL_JoyButtonEvent *buttonevent, input_event_
 			}
 			else if (native_key == INPUT_KEY_Escape)
 			{
-				fuse_exiting = 1;
+				quit();
 				break;
 			}
 		}
@@ -684,24 +899,18 @@ extern "C" int ui_init(int *argc, char ***argv)
 
 	gtk_widget_show_all(widget);
 
-	while (!fuse_exiting)
+	// Set up the machine once; each game started from the menu just
+	// resets it
+	if (machine_init())
 	{
-		if (zx80.get())
-		{
-			z80_do_opcodes();
-			event_do_events();
-		}
-		else
-		{
-			ui_joystick_poll();
-		}
+		fprintf(stderr, "Failed to initialize the machine\n");
+		exit(-1);
+	}
+
+	// Everything from here on is driven by the main loop: the menu waits
+	// for input, and the game for its drawing area's frame clock
+	gtk_main();
 
-		while (gtk_events_pending() && !fuse_exiting)
-		{
-			gtk_main_iteration();
-		}
-	}	
-	
 	return 0;
 }
 
@@ -180,7 +180,8 @@ ay_dataport_write( libspectrum_word port GCC_UNUSED, libspectrum_byte b )
   current = machine_current->ay.current_register;
 
   machine_current->ay.registers[ current ] = b & mask[ current ];
-  sound_ay_write( current, b, tstates );
+  sound_ay_write( current, machine_current->ay.registers[ current ],
+                  tstates );
   if( psg_recording ) psg_write_register( current, b );
 
   if( current == 14 ) printer_serial_write( b );
@@ -27,6 +27,22 @@ partially reimplemented in C by Gergely Szasz for FUSE
 
 #include "blipbuffer.h"
 
+/* The vector versions work on buf_t_ as 64-bit lanes, so are only built
+   where long is 64 bits; not on LLP64 targets such as MinGW-w64 */
+#if defined( __GNUC__ ) && defined( __x86_64__ ) && defined( __LP64__ )
+#define BLIP_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined( __aarch64__ ) && defined( __LP64__ )
+#define BLIP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined( BLIP_X86 ) || defined( BLIP_NEON )
+typedef char blip_buf_t_is_64_bits[ sizeof( buf_t_ ) == 8 ? 1 : -1 ];
+#endif
+
 
 static void _blip_synth_init( Blip_Synth_ * synth_, short *impulses );
 
@@ -50,6 +66,25 @@ blip_synth_set_output( Blip_Synth * synth, Blip_Buffer * b )
   synth->impl.last_amp = 0;
 }
 
+/* Lay the impulses out per phase in the order blip_synth_offset_resampled()
+   adds them: the first half of the taps come forwards from
+   'impulses + BLIP_RES - phase', the second half backwards from
+   'impulses + phase' */
+static void
+blip_synth_build_kernels( Blip_Synth * synth )
+{
+  int phase, i, half = BLIP_SYNTH_QUALITY / 2;
+
+  imp_t *kernel = synth->kernels;
+
+  for( phase = 0; phase < BLIP_RES; phase++ ) {
+    for( i = 0; i < half; i++ )
+      *kernel++ = synth->impulses[BLIP_RES - phase + BLIP_RES * i];
+    for( i = half; i--; )
+      *kernel++ = synth->impulses[phase + BLIP_RES * i];
+  }
+}
+
 void
 blip_synth_set_volume( Blip_Synth * synth, double v )
 {
@@ -58,6 +93,139 @@ blip_synth_set_volume( Blip_Synth * synth, double v )
                                  ( BLIP_SYNTH_RANGE <
                                    0 ? -( BLIP_SYNTH_RANGE ) :
                                    BLIP_SYNTH_RANGE ) ) );
+  blip_synth_build_kernels( synth );
+}
+
+/* Vector versions of blip_synth_offset_resampled(), each adding 'delta'
+   times a phase's kernel into the BLIP_SYNTH_QUALITY samples from 'buf'.
+   Every product is formed to 64 bits, as the plain C version does for
+   half of the taps; the other half it forms to int, which only differs
+   when the plain version would overflow. */
+
+typedef void ( *blip_add_fn )( const imp_t * kernel, buf_t_ * buf,
+                               int delta );
+
+#ifdef BLIP_X86
+
+/* SSE4.1 brings the signed 32x32->64 bit multiply; the SSE2 alternative
+   of an unsigned multiply and sign fixups is slower than plain C */
+__attribute__(( target( "sse4.1" ) ))
+static void
+blip_add_sse41( const imp_t * kernel, buf_t_ * buf, int delta )
+{
+  __m128i d = _mm_set1_epi64x( delta );
+  int i;
+
+  for( i = 0; i < BLIP_SYNTH_QUALITY; i += 4 ) {
+    __m128i k = _mm_loadl_epi64( ( const __m128i * )( kernel + i ) );
+    __m128i k01 = _mm_cvtepi16_epi64( k );
+    __m128i k23 = _mm_cvtepi16_epi64( _mm_srli_si128( k, 4 ) );
+    __m128i *b = ( __m128i * )( buf + i );
+
+    _mm_storeu_si128( b, _mm_add_epi64( _mm_loadu_si128( b ),
+                                        _mm_mul_epi32( k01, d ) ) );
+    _mm_storeu_si128( b + 1, _mm_add_epi64( _mm_loadu_si128( b + 1 ),
+                                            _mm_mul_epi32( k23, d ) ) );
+  }
+}
+
+__attribute__(( target( "avx2" ) ))
+static void
+blip_add_avx2( const imp_t * kernel, buf_t_ * buf, int delta )
+{
+  __m256i d = _mm256_set1_epi64x( delta );
+  int i;
+
+  for( i = 0; i < BLIP_SYNTH_QUALITY; i += 4 ) {
+    __m256i k =
+      _mm256_cvtepi16_epi64( _mm_loadl_epi64( ( const __m128i * )
+                                              ( kernel + i ) ) );
+    __m256i b = _mm256_loadu_si256( ( const __m256i * )( buf + i ) );
+
+    b = _mm256_add_epi64( b, _mm256_mul_epi32( k, d ) );
+    _mm256_storeu_si256( ( __m256i * )( buf + i ), b );
+  }
+}
+
+#endif                          /* #ifdef BLIP_X86 */
+
+#ifdef BLIP_NEON
+
+static void
+blip_add_neon( const imp_t * kernel, buf_t_ * buf, int delta )
+{
+  int32x2_t d = vdup_n_s32( delta );
+  int i;
+
+  for( i = 0; i < BLIP_SYNTH_QUALITY; i += 4 ) {
+    int32x4_t k = vmovl_s16( vld1_s16( kernel + i ) );
+    int64_t *b = ( int64_t * )buf + i;
+
+    vst1q_s64( b, vmlal_s32( vld1q_s64( b ), vget_low_s32( k ), d ) );
+    vst1q_s64( b + 2, vmlal_s32( vld1q_s64( b + 2 ), vget_high_s32( k ), d ) );
+  }
+}
+
+#endif                          /* #ifdef BLIP_NEON */
+
+/* NULL for the plain C version */
+static blip_add_fn blip_add = NULL;
+static int blip_simd_chosen = 0;
+
+static const char * const blip_simd_names[BLIP_SIMD_COUNT] = {
+  "none", "SSE4.1", "AVX2", "NEON",
+};
+
+static blip_add_fn
+blip_simd_fn( blip_simd_t simd )
+{
+  switch( simd ) {
+#ifdef BLIP_X86
+  case BLIP_SIMD_SSE41:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "sse4.1" ) ? blip_add_sse41 : NULL;
+  case BLIP_SIMD_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" ) ? blip_add_avx2 : NULL;
+#endif
+#ifdef BLIP_NEON
+  case BLIP_SIMD_NEON:
+    return blip_add_neon;
+#endif
+  default:
+    return NULL;
+  }
+}
+
+blip_simd_t
+blip_simd_best( void )
+{
+  int simd;
+
+  for( simd = BLIP_SIMD_COUNT; --simd > BLIP_SIMD_NONE; )
+    if( blip_simd_fn( simd ) )
+      break;
+
+  return simd;
+}
+
+int
+blip_simd_select( blip_simd_t simd )
+{
+  blip_add_fn fn = blip_simd_fn( simd );
+
+  if( !fn && simd != BLIP_SIMD_NONE )
+    return 1;
+
+  blip_add = fn;
+  blip_simd_chosen = 1;
+  return 0;
+}
+
+const char *
+blip_simd_name( blip_simd_t simd )
+{
+  return simd < BLIP_SIMD_COUNT ? blip_simd_names[simd] : "unknown";
 }
 
 #define BLIP_FWD( i )                     \
@@ -88,13 +256,19 @@ blip_synth_offset_resampled( Blip_Synth * synth, blip_resampled_time_t time,
   phase =
     ( int )( time >> ( BLIP_BUFFER_ACCURACY - BLIP_PHASE_BITS ) &
              ( BLIP_RES - 1 ) );
-  imp = synth->impulses + BLIP_RES - phase;
   buf = blip_buf->buffer_ + ( time >> BLIP_BUFFER_ACCURACY );
-  i0 = *imp;
 
   fwd = ( BLIP_WIDEST_IMPULSE_ - BLIP_SYNTH_QUALITY ) / 2;
   rev = fwd + BLIP_SYNTH_QUALITY - 2;
 
+  if( blip_add ) {
+    blip_add( synth->kernels + phase * BLIP_SYNTH_QUALITY, buf + fwd, delta );
+    return;
+  }
+
+  imp = synth->impulses + BLIP_RES - phase;
+  i0 = *imp;
+
   BLIP_FWD( 0 );
   if( BLIP_SYNTH_QUALITY > 8 ) {
     BLIP_FWD( 2 );
@@ -154,6 +328,7 @@ blip_synth_set_treble_eq( Blip_Synth * synth, double treble )
   eq.treble = treble;
 
   _blip_synth_treble_eq( &synth->impl, &eq );
+  blip_synth_build_kernels( synth );
 }
 
 #define BUFFER_EXTRA ( BLIP_WIDEST_IMPULSE_ + 2 )
@@ -213,6 +388,8 @@ blip_synth_init( Blip_Synth * synth )
   if( synth->impulses ) {
     _blip_synth_init( &synth->impl, ( short * )synth->impulses );       /* sorry, somewhere imp_t, somewhere short ???? */
   }
+  synth->kernels =
+    calloc( BLIP_RES * BLIP_SYNTH_QUALITY, sizeof( imp_t ) );
 }
 
 static void
@@ -222,6 +399,10 @@ blip_synth_end( Blip_Synth * synth )
     free( synth->impulses );
     synth->impulses = NULL;
   }
+  if( synth->kernels ) {
+    free( synth->kernels );
+    synth->kernels = NULL;
+  }
 }
 
 Blip_Synth *
@@ -229,10 +410,14 @@ new_Blip_Synth( void )
 {
   Blip_Synth *ret;
 
+  if( !blip_simd_chosen )
+    blip_simd_select( blip_simd_best() );
+
   ret = malloc( sizeof( Blip_Synth ) );
   if( ret ) {
     blip_synth_init( ret );
-    if( !ret->impulses ) {
+    if( !ret->impulses || !ret->kernels ) {
+      blip_synth_end( ret );
       free( ret );
       return NULL;
     }
@@ -615,3 +800,61 @@ blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
 
   return count;
 }
+
+long
+blip_buffer_read_samples_stereo( Blip_Buffer * left, Blip_Buffer * right,
+                                 blip_sample_t * out, long max_samples )
+{
+  long count = blip_buffer_samples_avail( left );
+
+  /* Both buffers are always ended together, but don't rely on it */
+  if( blip_buffer_samples_avail( right ) != count ) {
+    count = blip_buffer_read_samples( left, out, max_samples, 1 );
+    blip_buffer_read_samples( right, out + 1, count, 1 );
+    return count;
+  }
+
+  if( count > max_samples )
+    count = max_samples;
+
+  if( count ) {
+    int sample_shift = BLIP_SAMPLE_BITS - 16;
+
+    int left_shift = left->bass_shift, right_shift = right->bass_shift;
+
+    long left_accum = left->reader_accum, right_accum = right->reader_accum;
+
+    buf_t_ *left_in = left->buffer_, *right_in = right->buffer_;
+
+    int n;
+
+    /* The two channels' integrations don't depend on each other, so the
+       processor can overlap them */
+    for( n = count; n--; ) {
+      long l = left_accum >> sample_shift;
+
+      long r = right_accum >> sample_shift;
+
+      left_accum -= left_accum >> left_shift;
+      right_accum -= right_accum >> right_shift;
+      left_accum += *left_in++;
+      right_accum += *right_in++;
+      out[0] = ( blip_sample_t ) l;
+      out[1] = ( blip_sample_t ) r;
+
+      /* clamp samples */
+      if( ( blip_sample_t ) l != l )
+        out[0] = ( blip_sample_t ) ( 0x7FFF - ( l >> 24 ) );
+      if( ( blip_sample_t ) r != r )
+        out[1] = ( blip_sample_t ) ( 0x7FFF - ( r >> 24 ) );
+      out += 2;
+    }
+
+    left->reader_accum = left_accum;
+    right->reader_accum = right_accum;
+    blip_buffer_remove_samples( left, count );
+    blip_buffer_remove_samples( right, count );
+  }
+
+  return count;
+}
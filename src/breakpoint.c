@@ -43,6 +43,20 @@ GSList *debugger_breakpoints;
 /* The next breakpoint ID to use */
 static size_t next_breakpoint_id;
 
+/* For the address and port breakpoint types, a bit for each of the 64K
+   addresses or ports which could trigger a breakpoint of that type. Checked
+   before the list is walked, so that the usual case of nothing to do is a
+   single bit test however many breakpoints there are. Rebuilt whenever the
+   list changes */
+#define INDEXED_TYPES ( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE + 1 )
+
+static libspectrum_byte breakpoint_index[ INDEXED_TYPES ][ 0x10000 / 8 ];
+
+#define index_set( type, value ) \
+  ( breakpoint_index[ (type) ][ (value) >> 3 ] |= 1 << ( (value) & 7 ) )
+#define index_test( type, value ) \
+  ( breakpoint_index[ (type) ][ (value) >> 3 ] & ( 1 << ( (value) & 7 ) ) )
+
 /* Textual representations of the breakpoint types and lifetimes */
 const char *debugger_breakpoint_type_text[] = {
   "Execute", "Read", "Write", "Port Read", "Port Write", "Time", "Event",
@@ -77,6 +91,7 @@ static gint find_breakpoint_by_address( gconstpointer data,
 					gconstpointer user_data );
 static void free_breakpoint( gpointer data, gpointer user_data );
 static void add_time_event( gpointer data, gpointer user_data );
+static void index_rebuild( void );
 
 /* Add a breakpoint */
 int
@@ -210,9 +225,13 @@ breakpoint_add( debugger_breakpoint_type type, debugger_breakpoint_value value,
     bp->condition = NULL;
   }
 
+  bp->program = bp->condition ?
+                debugger_expression_compile( bp->condition ) : NULL;
+
   bp->commands = NULL;
 
   debugger_breakpoints = g_slist_append( debugger_breakpoints, bp );
+  index_rebuild();
 
   if( debugger_mode == DEBUGGER_MODE_INACTIVE )
     debugger_mode = DEBUGGER_MODE_ACTIVE;
@@ -237,6 +256,9 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
   case DEBUGGER_MODE_INACTIVE: return 0;
 
   case DEBUGGER_MODE_ACTIVE:
+    if( type < INDEXED_TYPES && !index_test( type, value & 0xffff ) )
+      return 0;
+
     for( ptr = debugger_breakpoints; ptr; ptr = ptr_next ) {
 
       bp = ptr->data;
@@ -248,7 +270,8 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
 
         if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
           debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
-          free( bp );
+          free_breakpoint( bp, NULL );
+          index_rebuild();
         }
       }
 
@@ -292,8 +315,11 @@ debugger_breakpoint_trigger( debugger_breakpoint *bp )
 {
   if( bp->ignore ) { bp->ignore--; return 0; }
 
-  if( bp->condition && !debugger_expression_evaluate( bp->condition ) )
+  if( bp->program ) {
+    if( !debugger_program_run( bp->program ) ) return 0;
+  } else if( bp->condition && !debugger_expression_evaluate( bp->condition ) ) {
     return 0;
+  }
 
   if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME )
     bp->value.time.triggered = 1;
@@ -363,6 +389,7 @@ debugger_breakpoint_remove( size_t id )
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
   debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+  index_rebuild();
   if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
     debugger_mode = DEBUGGER_MODE_INACTIVE;
 
@@ -377,7 +404,7 @@ debugger_breakpoint_remove( size_t id )
     event_foreach( remove_time, &remove );
   }
 
-  free( bp );
+  free_breakpoint( bp, NULL );
 
   return 0;
 }
@@ -447,6 +474,8 @@ debugger_breakpoint_clear( libspectrum_word address )
       debugger_mode = DEBUGGER_MODE_INACTIVE;
   }
 
+  if( found ) index_rebuild();
+
   if( !found ) {
     if( debugger_output_base == 10 ) {
       ui_error( UI_ERROR_ERROR, "No breakpoint at %d", address );
@@ -481,6 +510,7 @@ debugger_breakpoint_remove_all( void )
 {
   g_slist_foreach( debugger_breakpoints, free_breakpoint, NULL );
   g_slist_free( debugger_breakpoints ); debugger_breakpoints = NULL;
+  index_rebuild();
 
   if( debugger_mode == DEBUGGER_MODE_ACTIVE )
     debugger_mode = DEBUGGER_MODE_INACTIVE;
@@ -513,6 +543,7 @@ free_breakpoint( gpointer data, gpointer user_data GCC_UNUSED )
   }
 
   if( bp->condition ) debugger_expression_delete( bp->condition );
+  debugger_program_free( bp->program );
   if( bp->commands ) free( bp->commands );
 
   free( bp );
@@ -540,10 +571,12 @@ debugger_breakpoint_set_condition( size_t id, debugger_expression *condition )
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
   if( bp->condition ) debugger_expression_delete( bp->condition );
+  debugger_program_free( bp->program ); bp->program = NULL;
 
   if( condition ) {
     bp->condition = debugger_expression_copy( condition );
     if( !bp->condition ) return 1;
+    bp->program = debugger_expression_compile( bp->condition );
   } else {
     bp->condition = NULL;
   }
@@ -589,3 +622,53 @@ debugger_breakpoint_time_fn( libspectrum_dword tstates, int type GCC_UNUSED,
 {
   debugger_check( DEBUGGER_BREAKPOINT_TYPE_TIME, 0 );
 }
+
+static void
+index_add( gpointer data, gpointer user_data GCC_UNUSED )
+{
+  debugger_breakpoint *bp = data;
+  libspectrum_word offset, port, mask;
+  size_t i;
+
+  switch( bp->type ) {
+
+  case DEBUGGER_BREAKPOINT_TYPE_EXECUTE:
+  case DEBUGGER_BREAKPOINT_TYPE_READ:
+  case DEBUGGER_BREAKPOINT_TYPE_WRITE:
+    offset = bp->value.address.offset;
+
+    /* A page-specific breakpoint could be hit through any of the four 16K
+       slots, depending on what's paged in where */
+    if( bp->value.address.source == memory_source_any ) {
+      index_set( bp->type, offset );
+    } else {
+      for( i = 0; i < 4; i++ )
+        index_set( bp->type, ( i << 14 ) | ( offset & 0x3fff ) );
+    }
+    break;
+
+  case DEBUGGER_BREAKPOINT_TYPE_PORT_READ:
+  case DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE:
+    port = bp->value.port.port; mask = bp->value.port.mask;
+
+    /* Nothing matches if the port has bits outside the mask */
+    if( port & ~mask ) break;
+
+    for( i = 0; i < 0x10000; i++ )
+      if( ( i & mask ) == port ) index_set( bp->type, i );
+    break;
+
+  case DEBUGGER_BREAKPOINT_TYPE_TIME:
+  case DEBUGGER_BREAKPOINT_TYPE_EVENT:
+    /* Only checked when their events happen */
+    break;
+
+  }
+}
+
+static void
+index_rebuild( void )
+{
+  memset( breakpoint_index, 0, sizeof( breakpoint_index ) );
+  g_slist_foreach( debugger_breakpoints, index_add, NULL );
+}
@@ -198,6 +198,64 @@ debugger_register_get( int which )
   }
 }
 
+/* Where a register is stored, for expressions which read it directly.
+   Sets *word if it is a 16-bit register; NULL for an unknown register */
+const void*
+debugger_register_address( int which, int *word )
+{
+  *word = 0;
+
+  switch( which ) {
+
+    /* 8-bit registers */
+  case 0x0061: return &A;
+  case 0x8061: return &A_;
+  case 0x0066: return &F;
+  case 0x8066: return &F_;
+  case 0x0062: return &B;
+  case 0x8062: return &B_;
+  case 0x0063: return &C;
+  case 0x8063: return &C_;
+  case 0x0064: return &D;
+  case 0x8064: return &D_;
+  case 0x0065: return &E;
+  case 0x8065: return &E_;
+  case 0x0068: return &H;
+  case 0x8068: return &H_;
+  case 0x006c: return &L;
+  case 0x806c: return &L_;
+
+   /* interrupt flags */
+  case 0x696d: return &IM;
+  case 0x69666631: return &IFF1;
+  case 0x69666632: return &IFF2;
+
+  }
+
+  *word = 1;
+
+  switch( which ) {
+
+    /* 16-bit registers */
+  case 0x6166: return &AF;
+  case 0xe166: return &AF_;
+  case 0x6263: return &BC;
+  case 0xe263: return &BC_;
+  case 0x6465: return &DE;
+  case 0xe465: return &DE_;
+  case 0x686c: return &HL;
+  case 0xe86c: return &HL_;
+
+  case 0x7370: return &SP;
+  case 0x7063: return &PC;
+  case 0x6978: return &IX;
+  case 0x6979: return &IY;
+
+  }
+
+  return NULL;
+}
+
 /* Set the value of a register */
 void
 debugger_register_set( int which, libspectrum_word value )
@@ -180,6 +180,8 @@ dck_reset( void )
             } else {
               memset( page->page, 0, MEMORY_PAGE_SIZE );
             }
+            if( page->source == memory_source_ram )
+              memory_ram_set_written( page->page_num );
           }
         } else {
           data = memory_pool_allocate( 0x2000 );
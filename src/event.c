@@ -25,12 +25,14 @@
 
 #include <config.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <libspectrum.h>
 
 #include "event.h"
 #include "fuse.h"
+#include "perf.h"
 #include "ui/ui.h"
 #include "utils.h"
 
@@ -40,11 +42,42 @@ static const libspectrum_dword event_no_events = 0xffffffff;
 /* When will the next event happen? */
 libspectrum_dword event_next_event;
 
-/* The actual list of events */
-static GSList *event_list = NULL;
+/* An entry in the event queue. Times are stored relative to a fixed
+   epoch rather than to the start of the current frame, so the end of
+   frame only has to move the epoch, not touch every event */
+typedef struct event_entry_t {
 
-/* An event ready to be reused */
-static event_t *event_free = NULL;
+  /* When the event happens: event.tstates plus event_epoch at the time
+     it was added */
+  libspectrum_qword time;
+
+  /* The type the event was added with. Unlike event.type, this never
+     changes, so the heap ordering stays valid if the event is deleted */
+  int key_type;
+
+  /* Events with identical time and type are done most recent first */
+  libspectrum_dword sequence;
+
+  /* The generation of key_type when the event was added; if the type has
+     been removed since, the event is dead */
+  libspectrum_dword generation;
+
+  /* The event itself; tstates is only brought up to date when the entry
+     is handed to someone else */
+  event_t event;
+
+} event_entry_t;
+
+/* The event queue, as a binary min-heap in a single array which is
+   reused for the lifetime of the emulator */
+static event_entry_t *event_heap = NULL;
+static size_t event_heap_count = 0, event_heap_size = 0;
+
+/* The absolute time of tstate 0 in the current frame */
+static libspectrum_qword event_epoch = 0;
+
+/* Incremented for each event added */
+static libspectrum_dword event_sequence = 0;
 
 /* A null event */
 int event_type_null;
@@ -52,6 +85,7 @@ int event_type_null;
 typedef struct event_descriptor_t {
   event_fn_t fn;
   char *description;
+  libspectrum_dword generation;	/* Bumped by event_remove_type() */
 } event_descriptor_t; 
 
 static GArray *registered_events;
@@ -73,95 +107,165 @@ event_register( event_fn_t fn, const char *description )
 
   descriptor.fn = fn;
   descriptor.description = utils_safe_strdup( description );
+  descriptor.generation = 0;
 
   g_array_append_val( registered_events, descriptor );
 
   return registered_events->len - 1;
 }
 
-static gint
-event_add_cmp( gconstpointer a1, gconstpointer b1 )
+/* Should entry a be done before entry b? */
+static inline int
+event_before( const event_entry_t *a, const event_entry_t *b )
+{
+  if( a->time != b->time ) return a->time < b->time;
+  if( a->key_type != b->key_type ) return a->key_type < b->key_type;
+  return (libspectrum_signed_dword)( a->sequence - b->sequence ) > 0;
+}
+
+/* Mark the entry's event as deleted if its type has been removed since
+   it was added */
+static inline void
+event_entry_check_live( event_entry_t *entry )
+{
+  if( entry->event.type != event_type_null &&
+      entry->generation !=
+        g_array_index( registered_events, event_descriptor_t,
+                       entry->key_type ).generation )
+    entry->event.type = event_type_null;
+}
+
+/* Set when the event at the root of the heap has been done but not yet
+   taken out of the heap. Most event handlers add another event, which
+   can then simply take the root's place */
+static int event_root_done = 0;
+
+static void
+event_update_next_event( void )
+{
+  const event_entry_t *next;
+
+  if( !event_root_done ) {
+    next = event_heap_count ? &event_heap[0] : NULL;
+  } else if( event_heap_count > 2 ) {
+    next = event_before( &event_heap[1], &event_heap[2] ) ? &event_heap[1]
+                                                          : &event_heap[2];
+  } else {
+    next = event_heap_count > 1 ? &event_heap[1] : NULL;
+  }
+
+  event_next_event =
+    next ? (libspectrum_dword)( next->time - event_epoch ) : event_no_events;
+}
+
+/* Put entry into the heap at position i, moving it down until it is
+   in order with everything below it */
+static void
+event_sift_down( size_t i, const event_entry_t *entry )
 {
-  const event_t *a = a1, *b = b1;
+  size_t child;
+
+  while( ( child = 2 * i + 1 ) < event_heap_count ) {
+    if( child + 1 < event_heap_count &&
+        event_before( &event_heap[ child + 1 ], &event_heap[ child ] ) )
+      child++;
+    if( !event_before( &event_heap[ child ], entry ) ) break;
+    event_heap[i] = event_heap[ child ];
+    i = child;
+  }
+  event_heap[i] = *entry;
+}
 
-  return a->tstates != b->tstates ? a->tstates - b->tstates
-		                  : a->type - b->type;
+/* Take a done root out of the heap if nothing replaced it */
+static void
+event_remove_done_root( void )
+{
+  if( !event_root_done ) return;
+
+  event_root_done = 0;
+  if( --event_heap_count ) event_sift_down( 0, &event_heap[ event_heap_count ] );
+
+  event_update_next_event();
 }
 
 /* Add an event at the correct place in the event list */
 void
 event_add_with_data( libspectrum_dword event_time, int type, void *user_data )
 {
-  event_t *ptr;
-
-  if( event_free ) {
-    ptr = event_free;
-    event_free = NULL;
-  } else {
-    ptr = libspectrum_malloc( sizeof( *ptr ) );
+  event_entry_t entry;
+  size_t i, parent;
+
+  entry.time = event_epoch + event_time;
+  entry.key_type = type;
+  entry.sequence = event_sequence++;
+  entry.generation =
+    g_array_index( registered_events, event_descriptor_t, type ).generation;
+  entry.event.tstates = event_time;
+  entry.event.type = type;
+  entry.event.user_data = user_data;
+
+  if( event_root_done ) {
+    event_root_done = 0;
+    event_sift_down( 0, &entry );
+    event_update_next_event();
+    return;
   }
 
-  ptr->tstates = event_time;
-  ptr->type =type;
-  ptr->user_data = user_data;
+  if( event_heap_count == event_heap_size ) {
+    event_heap_size = event_heap_size ? 2 * event_heap_size : 64;
+    event_heap = libspectrum_realloc( event_heap,
+                                      event_heap_size * sizeof( *event_heap ) );
+  }
 
-  if( event_time < event_next_event ) {
-    event_next_event = event_time;
-    event_list = g_slist_prepend( event_list, ptr );
-  } else {
-    event_list = g_slist_insert_sorted( event_list, ptr, event_add_cmp );
+  /* Sift up from the end of the heap */
+  i = event_heap_count++;
+  while( i ) {
+    parent = ( i - 1 ) / 2;
+    if( !event_before( &entry, &event_heap[ parent ] ) ) break;
+    event_heap[i] = event_heap[ parent ];
+    i = parent;
   }
+  event_heap[i] = entry;
+
+  if( !i ) event_next_event = event_time;
 }
 
 /* Do all events which have passed */
 int
 event_do_events( void )
 {
-  event_t *ptr;
+  event_entry_t entry;
+  event_fn_t fn;
+  perf_phase previous_phase = perf_enter( PERF_PHASE_EVENTS );
 
   while(event_next_event <= tstates) {
-    ptr = event_list->data;
-    event_descriptor_t descriptor =
-      g_array_index( registered_events, event_descriptor_t, ptr->type );
+    entry = event_heap[0];
+    entry.event.tstates = event_next_event;
+    event_entry_check_live( &entry );
 
     /* Remove the event from the list *before* processing */
-    event_list = g_slist_remove( event_list, ptr );
-
-    if( event_list == NULL ) {
-      event_next_event = event_no_events;
-    } else {
-      event_next_event = ((event_t*)(event_list->data))->tstates;
-    }
+    event_root_done = 1;
+    event_update_next_event();
 
-    if( descriptor.fn ) descriptor.fn( ptr->tstates, ptr->type, ptr->user_data );
+    fn = g_array_index( registered_events, event_descriptor_t,
+                        entry.event.type ).fn;
+    if( fn ) fn( entry.event.tstates, entry.event.type, entry.event.user_data );
 
-    if( event_free ) {
-      libspectrum_free( ptr );
-    } else {
-      event_free = ptr;
-    }
+    event_remove_done_root();
   }
 
-  return 0;
-}
+  perf_leave( previous_phase );
 
-static void
-event_reduce_tstates( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-  libspectrum_dword *tstates_per_frame = user_data;
-
-  ptr->tstates -= *tstates_per_frame;
+  return 0;
 }
 
 /* Called at end of frame to reduce T-state count of all entries */
 void
 event_frame( libspectrum_dword tstates_per_frame )
 {
-  g_slist_foreach( event_list, event_reduce_tstates, &tstates_per_frame );
+  event_epoch += tstates_per_frame;
 
-  event_next_event = event_list ?
-    ((event_t*)(event_list->data))->tstates : event_no_events;
+  event_update_next_event();
 }
 
 /* Do all events that would happen between the current time and when
@@ -181,69 +285,74 @@ event_force_events( void )
   }
 }
 
-static void
-set_event_null( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-  int *type = user_data;
-
-  if( ptr->type == *type ) ptr->type = event_type_null;
-}
-
-static void
-set_event_null_with_user_data( gpointer data, gpointer user_data )
-{
-  event_t *event = data;
-  event_t *template = user_data;
-
-  if( event->type == template->type && event->user_data == template->user_data )
-    event->type = event_type_null;
-}
-
-/* Remove all events of a specific type from the stack */
+/* Remove all events of a specific type from the stack. The events stay
+   in the heap until they come due, but are then ignored */
 void
 event_remove_type( int type )
 {
-  g_slist_foreach( event_list, set_event_null, &type );
+  g_array_index( registered_events, event_descriptor_t, type ).generation++;
 }
 
 /* Remove all events of a specific type and user data from the stack */
 void
 event_remove_type_user_data( int type, gpointer user_data )
 {
-  event_t template;
+  size_t i;
+  event_entry_t *entry;
 
-  template.type = type;
-  template.user_data = user_data;
-  g_slist_foreach( event_list, set_event_null_with_user_data, &template );
-}
+  event_remove_done_root();
 
-/* Free the memory used by a specific entry */
-static void
-event_free_entry( gpointer data, gpointer user_data GCC_UNUSED )
-{
-  libspectrum_free( data );
+  for( i = 0; i < event_heap_count; i++ ) {
+    entry = &event_heap[i];
+    if( entry->event.user_data != user_data ) continue;
+    event_entry_check_live( entry );
+    if( entry->event.type == type ) entry->event.type = event_type_null;
+  }
 }
 
 /* Clear the event stack */
 void
 event_reset( void )
 {
-  g_slist_foreach( event_list, event_free_entry, NULL );
-  g_slist_free( event_list );
-  event_list = NULL;
+  event_heap_count = 0;
+  event_root_done = 0;
+  event_epoch = 0;
 
   event_next_event = event_no_events;
+}
+
+static int
+event_foreach_cmp( const void *a1, const void *b1 )
+{
+  const event_entry_t *a = *(event_entry_t* const*)a1,
+                      *b = *(event_entry_t* const*)b1;
 
-  libspectrum_free( event_free );
-  event_free = NULL;
+  return event_before( a, b ) ? -1 : event_before( b, a ) ? 1 : 0;
 }
 
-/* Call a user-supplied function for every event in the current list */
+/* Call a user-supplied function for every event in the current list, in
+   the order they will happen */
 void
 event_foreach( GFunc function, gpointer user_data )
 {
-  g_slist_foreach( event_list, function, user_data );
+  size_t i;
+  event_entry_t **sorted;
+
+  event_remove_done_root();
+
+  if( !event_heap_count ) return;
+
+  sorted = libspectrum_malloc( event_heap_count * sizeof( *sorted ) );
+  for( i = 0; i < event_heap_count; i++ ) sorted[i] = &event_heap[i];
+  qsort( sorted, event_heap_count, sizeof( *sorted ), event_foreach_cmp );
+
+  for( i = 0; i < event_heap_count; i++ ) {
+    sorted[i]->event.tstates = sorted[i]->time - event_epoch;
+    event_entry_check_live( sorted[i] );
+    function( &sorted[i]->event, user_data );
+  }
+
+  libspectrum_free( sorted );
 }
 
 /* A textual representation of each event type */
@@ -275,5 +384,10 @@ void
 event_end( void )
 {
   event_reset();
+
+  libspectrum_free( event_heap );
+  event_heap = NULL;
+  event_heap_size = 0;
+
   registered_events_free();
 }
@@ -433,6 +433,261 @@ evaluate_binaryop( struct binaryop_type *binary )
   fuse_abort();
 }
 
+/* Compiled expressions.
+
+   Evaluating the tree means a recursive call and a switch for every node,
+   and a lookup by name for every register, which is a lot for a condition
+   checked on every instruction. So breakpoint conditions are compiled
+   into a flat list of instructions for a stack machine, with registers
+   resolved to where they're stored. The logical operators jump past their
+   second operand when the first decides the result, as the tree version
+   doesn't evaluate it either */
+
+typedef enum program_opcode {
+
+  PROGRAM_NUMBER,		/* Push a number */
+  PROGRAM_BYTE,			/* Push an 8-bit register */
+  PROGRAM_WORD,			/* Push a 16-bit register */
+  PROGRAM_VARIABLE,		/* Push a variable */
+
+  PROGRAM_UNARYOP,		/* Replace the top value */
+  PROGRAM_BINARYOP,		/* Replace the top two values */
+
+  PROGRAM_JUMP_IF_FALSE,	/* If the top value is zero, jump, leaving
+				   it; otherwise drop it */
+  PROGRAM_JUMP_IF_TRUE,		/* If the top value is non-zero, replace it
+				   with 1 and jump; otherwise drop it */
+  PROGRAM_TRUTH,		/* Replace the top value with 0 or 1 */
+
+} program_opcode;
+
+typedef struct program_instruction {
+
+  program_opcode opcode;
+
+  union {
+    libspectrum_dword number;
+    const libspectrum_byte *byte;
+    const libspectrum_word *word;
+    char *variable;
+    int operation;
+    size_t target;
+  } arg;
+
+} program_instruction;
+
+struct debugger_program {
+
+  program_instruction *code;
+  size_t length, allocated;
+
+  libspectrum_dword *stack;
+  size_t depth;
+
+};
+
+static program_instruction*
+program_emit( debugger_program *program, program_opcode opcode )
+{
+  program_instruction *instruction;
+
+  if( program->length == program->allocated ) {
+    program->allocated = program->allocated ? 2 * program->allocated : 16;
+    program->code = libspectrum_realloc(
+      program->code, program->allocated * sizeof( *program->code )
+    );
+  }
+
+  instruction = &program->code[ program->length++ ];
+  instruction->opcode = opcode;
+
+  return instruction;
+}
+
+/* Emit code for 'exp', which will be at 'depth' on the stack */
+static int
+program_compile( debugger_program *program, debugger_expression *exp,
+                 size_t depth )
+{
+  program_instruction *instruction;
+  const void *address;
+  size_t jump;
+  int word, operation, error;
+
+  if( depth + 1 > program->depth ) program->depth = depth + 1;
+
+  switch( exp->type ) {
+
+  case DEBUGGER_EXPRESSION_TYPE_INTEGER:
+    program_emit( program, PROGRAM_NUMBER )->arg.number =
+      exp->types.integer;
+    return 0;
+
+  case DEBUGGER_EXPRESSION_TYPE_REGISTER:
+    address = debugger_register_address( exp->types.reg, &word );
+    if( !address ) {
+      ui_error( UI_ERROR_ERROR, "unknown register '%d'", exp->types.reg );
+      return 1;
+    }
+    if( word ) {
+      program_emit( program, PROGRAM_WORD )->arg.word = address;
+    } else {
+      program_emit( program, PROGRAM_BYTE )->arg.byte = address;
+    }
+    return 0;
+
+  case DEBUGGER_EXPRESSION_TYPE_VARIABLE:
+    program_emit( program, PROGRAM_VARIABLE )->arg.variable =
+      utils_safe_strdup( exp->types.variable );
+    return 0;
+
+  case DEBUGGER_EXPRESSION_TYPE_UNARYOP:
+    error = program_compile( program, exp->types.unaryop.op, depth );
+    if( error ) return error;
+
+    program_emit( program, PROGRAM_UNARYOP )->arg.operation =
+      exp->types.unaryop.operation;
+    return 0;
+
+  case DEBUGGER_EXPRESSION_TYPE_BINARYOP:
+    operation = exp->types.binaryop.operation;
+
+    error = program_compile( program, exp->types.binaryop.op1, depth );
+    if( error ) return error;
+
+    if( operation == DEBUGGER_TOKEN_LOGICAL_AND ||
+        operation == DEBUGGER_TOKEN_LOGICAL_OR     ) {
+
+      jump = program->length;
+      program_emit( program, operation == DEBUGGER_TOKEN_LOGICAL_AND ?
+                             PROGRAM_JUMP_IF_FALSE : PROGRAM_JUMP_IF_TRUE );
+
+      error = program_compile( program, exp->types.binaryop.op2, depth );
+      if( error ) return error;
+
+      program_emit( program, PROGRAM_TRUTH );
+      program->code[ jump ].arg.target = program->length;
+
+      return 0;
+    }
+
+    error = program_compile( program, exp->types.binaryop.op2, depth + 1 );
+    if( error ) return error;
+
+    instruction = program_emit( program, PROGRAM_BINARYOP );
+    instruction->arg.operation = operation;
+    return 0;
+
+  }
+
+  ui_error( UI_ERROR_ERROR, "unknown expression type %d", exp->type );
+  fuse_abort();
+}
+
+debugger_program*
+debugger_expression_compile( debugger_expression *exp )
+{
+  debugger_program *program;
+
+  program = libspectrum_malloc( sizeof( *program ) );
+  program->code = NULL;
+  program->length = program->allocated = 0;
+  program->stack = NULL;
+  program->depth = 0;
+
+  if( program_compile( program, exp, 0 ) ) {
+    debugger_program_free( program );
+    return NULL;
+  }
+
+  program->stack =
+    libspectrum_malloc( program->depth * sizeof( *program->stack ) );
+
+  return program;
+}
+
+void
+debugger_program_free( debugger_program *program )
+{
+  size_t i;
+
+  if( !program ) return;
+
+  for( i = 0; i < program->length; i++ )
+    if( program->code[i].opcode == PROGRAM_VARIABLE )
+      free( program->code[i].arg.variable );
+
+  libspectrum_free( program->code );
+  libspectrum_free( program->stack );
+  libspectrum_free( program );
+}
+
+libspectrum_dword
+debugger_program_run( debugger_program *program )
+{
+  const program_instruction *pc = program->code,
+    *end = program->code + program->length;
+  libspectrum_dword *top = program->stack - 1, a;
+
+  while( pc < end ) {
+
+    switch( pc->opcode ) {
+
+    case PROGRAM_NUMBER: *++top = pc->arg.number; break;
+    case PROGRAM_BYTE: *++top = *pc->arg.byte; break;
+    case PROGRAM_WORD: *++top = *pc->arg.word; break;
+    case PROGRAM_VARIABLE:
+      *++top = debugger_variable_get( pc->arg.variable );
+      break;
+
+    case PROGRAM_UNARYOP:
+      switch( pc->arg.operation ) {
+      case '!': *top = !*top; break;
+      case '~': *top = ~*top; break;
+      case '-': *top = -*top; break;
+      }
+      break;
+
+    case PROGRAM_BINARYOP:
+      a = *top--;
+
+      switch( pc->arg.operation ) {
+      case '+': *top += a; break;
+      case '-': *top -= a; break;
+      case '*': *top *= a; break;
+      case '/': *top /= a; break;
+      case DEBUGGER_TOKEN_EQUAL_TO: *top = *top == a; break;
+      case DEBUGGER_TOKEN_NOT_EQUAL_TO: *top = *top != a; break;
+      case '>': *top = *top > a; break;
+      case '<': *top = *top < a; break;
+      case DEBUGGER_TOKEN_LESS_THAN_OR_EQUAL_TO: *top = *top <= a; break;
+      case DEBUGGER_TOKEN_GREATER_THAN_OR_EQUAL_TO: *top = *top >= a; break;
+      case '&': *top &= a; break;
+      case '^': *top ^= a; break;
+      case '|': *top |= a; break;
+      }
+      break;
+
+    case PROGRAM_JUMP_IF_FALSE:
+      if( !*top ) { pc = program->code + pc->arg.target; continue; }
+      top--;
+      break;
+
+    case PROGRAM_JUMP_IF_TRUE:
+      if( *top ) { *top = 1; pc = program->code + pc->arg.target; continue; }
+      top--;
+      break;
+
+    case PROGRAM_TRUTH: *top = !!*top; break;
+
+    }
+
+    pc++;
+  }
+
+  return *top;
+}
+
 int
 debugger_expression_deparse( char *buffer, size_t length,
 			     const debugger_expression *exp )
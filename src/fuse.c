@@ -89,6 +89,7 @@
 #include "spectrum.h"
 #include "tape.h"
 #include "timer/timer.h"
+#include "trace.h"
 #include "ui/ui.h"
 #include "unittests/unittests.h"
 #include "utils.h"
@@ -268,6 +269,8 @@ int machine_init( void )
   if( ui_mouse_present ) ui_mouse_grabbed = ui_mouse_grab( 1 );
 
   fuse_emulation_paused = 0;
+
+  return 0;
 }
 
 int creator_init( void )
@@ -772,6 +775,7 @@ static int fuse_end(void)
   settings_end();
 
   psg_end();
+  trace_stop();
   rzx_end();
   tape_end();
   debugger_end();
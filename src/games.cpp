@@ -0,0 +1,219 @@
+// Starting, leaving and going back to the embedded games.
+
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+
+#include "games.h"
+
+extern "C"
+{
+#include <config.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "keyboard.h"
+#include "machine.h"
+#include "memory.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "tape.h"
+#include "timer/timer.h"
+}
+
+using namespace std;
+
+// Container for embedded game sources.
+unique_ptr<map<string, vector<char> > > game_sources;
+
+// Container for embedded snapshots of the games once loaded, by game.
+unique_ptr<map<string, vector<char> > > snapshot_sources;
+
+// Games left for the menu, kept as snapshots in memory so that going back
+// to one carries on where it was left. Only the most recently left ones are
+// kept, to bound the memory used.
+class Suspended
+{
+	// How many games are kept. Each holds a copy of the machine's RAM,
+	// 128K on a 128K machine, so this caps the suspended games at 256K
+	// plus the rest of their state. Two covers going back and forth
+	// between a pair of games, which is how the menu gets used; the game
+	// before those starts afresh.
+	static const size_t max_games = 2;
+
+	// A suspended game: the machine's state other than RAM, and the RAM
+	struct Game
+	{
+		int igame;
+		libspectrum_snap *snap;
+		memory_ram_capture_t *ram;
+	};
+
+	// Most recently left first
+	list<Game> games;
+
+	// The RAM of the game last resumed, while it runs; its next capture
+	// only needs to copy the pages it has written to since
+	Game running;
+
+	static void free(Game& game)
+	{
+		libspectrum_snap_free(game.snap);
+		memory_ram_capture_free(game.ram);
+	}
+
+public :
+
+	Suspended()
+	{
+		running.igame = -1;
+		running.snap = NULL;
+		running.ram = NULL;
+	}
+
+	~Suspended()
+	{
+		for (list<Game>::iterator i = games.begin(), e = games.end(); i != e; i++)
+			free(*i);
+		memory_ram_capture_free(running.ram);
+	}
+
+	// Take a snapshot of the machine, running game #igame
+	void suspend(const int igame)
+	{
+		Game game;
+		game.igame = igame;
+		game.snap = libspectrum_snap_alloc();
+
+		// RAM is captured separately, so leave it out of the snapshot
+		int error = snapshot_copy_to_borrowed(game.snap);
+		memory_snapshot_unborrow(game.snap);
+		if (error)
+		{
+			fprintf(stderr, "Failed to suspend game #%d\n", igame);
+			libspectrum_snap_free(game.snap);
+			return;
+		}
+
+		game.ram = memory_ram_capture(
+			running.igame == igame ? running.ram : NULL, memory_ram_pages());
+		memory_ram_capture_free(running.ram);
+		running.igame = -1;
+		running.ram = NULL;
+
+		games.push_front(game);
+
+		if (games.size() > max_games)
+		{
+			free(games.back());
+			games.pop_back();
+		}
+	}
+
+	// Put game #igame back into the machine; returns false if it isn't
+	// suspended, or can't be restored
+	bool resume(const int igame)
+	{
+		for (list<Game>::iterator i = games.begin(), e = games.end(); i != e; i++)
+		{
+			if (i->igame != igame) continue;
+
+			// The machine is already set up and only needs its state put
+			// back, but the last game's tape mustn't carry on into this one
+			tape_stop();
+			int error = snapshot_copy_from_without_reset(i->snap);
+			if (!error) memory_ram_restore(i->ram);
+
+			memory_ram_capture_free(running.ram);
+			running.igame = error ? -1 : igame;
+			running.ram = error ? NULL : i->ram;
+
+			libspectrum_snap_free(i->snap);
+			if (error) memory_ram_capture_free(i->ram);
+			games.erase(i);
+
+			return !error;
+		}
+
+		return false;
+	}
+};
+
+static Suspended suspended;
+
+// Start game #igame from scratch
+static void load(const int igame)
+{
+	if (!game_sources.get())
+	{
+		fprintf(stderr, "Game sources list is empty\n");
+		exit(-1);
+	}
+
+	int ii = 0;
+	for (map<string, vector<char> >::iterator i = game_sources->begin(), e = game_sources->end(); i != e; i++)
+	{
+		if (ii != igame)
+		{
+			ii++;
+			continue;
+		}
+
+		const string& filename = i->first;
+		vector<char>& game = i->second;
+
+		// Start from the snapshot taken at build time once the game
+		// had loaded, if there is one, instead of loading the tape
+		if (snapshot_sources.get())
+		{
+			map<string, vector<char> >::iterator snapshot = snapshot_sources->find(filename);
+			if ((snapshot != snapshot_sources->end()) &&
+				!snapshot_read_buffer((unsigned char*)&snapshot->second[0], snapshot->second.size(),
+					LIBSPECTRUM_ID_SNAPSHOT_SZX))
+				break;
+
+			fprintf(stderr, "No usable snapshot for game \"%s\", loading from tape\n", filename.c_str());
+		}
+
+		int error = tape_read_buffer((unsigned char*)&game[0], game.size(), LIBSPECTRUM_ID_TAPE_TZX, filename.c_str(), TRUE);
+		if (error)
+		{
+			fprintf(stderr, "Error loading game \"%s\": errno = %d\n", filename.c_str(), error);
+			exit(-1);
+		}
+		break;
+	}
+}
+
+void Games::enter(const int igame)
+{
+	// Let go of any keys still held down when the last game was left
+	keyboard_release_all();
+
+	// Carry on where the game was left, if it is still suspended, or
+	// else start it afresh. The machine was set up once at startup;
+	// starting a game only needs it reset, as from the Fuse menu,
+	// before the tape goes in
+	if (!suspended.resume(igame))
+	{
+		machine_reset(0);
+		load(igame);
+	}
+
+	// Keep the last few seconds, to be able to go back through them
+	rewind_start();
+
+	// The timer event holds emulation at real time by sleeping, which
+	// would stall the main loop; the frame clock does that job there.
+	// Machine selection and autoloading re-add it, so drop it last.
+	event_remove_type(timer_event);
+}
+
+void Games::leave(const int igame, const bool suspend)
+{
+	if (suspend)
+		suspended.suspend(igame);
+
+	rewind_stop();
+}
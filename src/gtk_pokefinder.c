@@ -57,6 +57,7 @@ static int dialog_created = 0;
 static GtkWidget
   *dialog,			/* The dialog box itself */
   *count_label,			/* The number of possible locations */
+  *word_check,			/* Whether to look at 16 bit values */
   *location_list;		/* The list view of possible locations */
 
 static GtkTreeModel *location_model; /* The data of possible locations */
@@ -151,6 +152,9 @@ create_dialog( void )
 		    G_CALLBACK( gtkui_pokefinder_search ), NULL );
   gtk_box_pack_start( GTK_BOX( hbox ), entry, TRUE, TRUE, 5 );
 
+  word_check = gtk_check_button_new_with_label( "16 bit" );
+  gtk_box_pack_start( GTK_BOX( hbox ), word_check, TRUE, TRUE, 5 );
+
   vbox = gtk_box_new( GTK_ORIENTATION_VERTICAL, 0 );
   gtk_box_pack_start( GTK_BOX( hbox ), vbox, TRUE, TRUE, 5 );
 
@@ -186,7 +190,10 @@ static void
 gtkui_pokefinder_incremented( GtkWidget *widget GCC_UNUSED,
 			      gpointer user_data GCC_UNUSED )
 {
-  pokefinder_incremented();
+  if( gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON( word_check ) ) )
+    pokefinder_incremented_word();
+  else
+    pokefinder_incremented();
   update_pokefinder();
 }
 
@@ -194,7 +201,10 @@ static void
 gtkui_pokefinder_decremented( GtkWidget *widget GCC_UNUSED,
 			      gpointer user_data GCC_UNUSED )
 {
-  pokefinder_decremented();
+  if( gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON( word_check ) ) )
+    pokefinder_decremented_word();
+  else
+    pokefinder_decremented();
   update_pokefinder();
 }
 
@@ -202,16 +212,24 @@ static void
 gtkui_pokefinder_search( GtkWidget *widget, gpointer user_data GCC_UNUSED )
 {
   long value;
+  int word;
+
+  word = gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON( word_check ) );
 
   errno = 0;
   value = strtol( gtk_entry_get_text( GTK_ENTRY( widget ) ), NULL, 10 );
 
-  if( errno != 0 || value < 0 || value > 255 ) {
-    ui_error( UI_ERROR_ERROR, "Invalid value: use an integer from 0 to 255" );
+  if( errno != 0 || value < 0 || value > ( word ? 65535 : 255 ) ) {
+    ui_error( UI_ERROR_ERROR, word ?
+              "Invalid value: use an integer from 0 to 65535" :
+              "Invalid value: use an integer from 0 to 255" );
     return;
   }
 
-  pokefinder_search( value );
+  if( word )
+    pokefinder_search_word( value );
+  else
+    pokefinder_search( value );
   update_pokefinder();
 }
 
@@ -45,17 +45,11 @@ int image_scale;
 /* The height and width of a 1x1 image in pixels */
 int image_width, image_height;
 
-/* A copy of every pixel on the screen, replaceable by plotting directly into
-   rgb_image below */
-libspectrum_word
+/* Every pixel on the screen, already in the xRGB32 format of a cairo
+   CAIRO_FORMAT_RGB24 surface, so it can be painted without conversion */
+libspectrum_dword
   gtkdisplay_image[ 2 * DISPLAY_SCREEN_HEIGHT ][ DISPLAY_SCREEN_WIDTH ];
-ptrdiff_t gtkdisplay_pitch = DISPLAY_SCREEN_WIDTH * sizeof( libspectrum_word );
-
-/* An RGB image of the Spectrum screen; slightly bigger than the real
-   screen to handle the smoothing filters which read around each pixel */
-static guchar rgb_image[ 4 * 2 * ( DISPLAY_SCREEN_HEIGHT + 4 ) *
-                                 ( DISPLAY_SCREEN_WIDTH  + 3 )   ];
-static const gint rgb_pitch = ( DISPLAY_SCREEN_WIDTH + 3 ) * 4;
+ptrdiff_t gtkdisplay_pitch = DISPLAY_SCREEN_WIDTH * sizeof( libspectrum_dword );
 
 /* The colour palette */
 static const guchar rgb_colours[16][3] = {
@@ -83,6 +77,13 @@ static const guchar rgb_colours[16][3] = {
 libspectrum_dword gtkdisplay_colours[16];
 static libspectrum_dword bw_colours[16];
 
+/* Whichever of those is in use */
+static const libspectrum_dword *colours = gtkdisplay_colours;
+
+/* For each byte of screen data, a mask for each of its eight pixels: all
+   ones where the pixel is ink, all zeros where it is paper */
+static libspectrum_dword expand_mask[256][8];
+
 /* Colour format for the back buffer in endianess-order */
 typedef enum {
   FORMAT_x8r8g8b8,    /* Cairo  (GTK3) */
@@ -97,6 +98,7 @@ static int display_updated = 0;
 #endif                /* #if GTK_CHECK_VERSION( 3, 0, 0 ) */
 
 static int init_colours( colour_format_t format );
+static void init_expand_mask( void );
 
 static int
 init_colours( colour_format_t format )
@@ -148,6 +150,16 @@ init_colours( colour_format_t format )
   return 0;
 }
 
+static void
+init_expand_mask( void )
+{
+  int data, bit;
+
+  for( data = 0; data < 256; data++ )
+    for( bit = 0; bit < 8; bit++ )
+      expand_mask[ data ][ bit ] = ( data & ( 0x80 >> bit ) ) ? 0xffffffff : 0;
+}
+
 int
 uidisplay_init( int width, int height )
 {
@@ -155,16 +167,16 @@ uidisplay_init( int width, int height )
 	height = gtk_widget_get_allocated_height(gtkui_window);
 
   int x, y, error;
-  libspectrum_dword black;
   colour_format_t colour_format = FORMAT_x8r8g8b8;
 
   error = init_colours( colour_format ); if( error ) return error;
+  init_expand_mask();
 
-  black = settings_current.bw_tv ? bw_colours[0] : gtkdisplay_colours[0];
+  colours = settings_current.bw_tv ? bw_colours : gtkdisplay_colours;
 
-  for( y = 0; y < DISPLAY_SCREEN_HEIGHT + 4; y++ )
-    for( x = 0; x < DISPLAY_SCREEN_WIDTH + 3; x++ )
-      *(libspectrum_dword*)( rgb_image + y * rgb_pitch + 4 * x ) = black;
+  for( y = 0; y < 2 * DISPLAY_SCREEN_HEIGHT; y++ )
+    for( x = 0; x < DISPLAY_SCREEN_WIDTH; x++ )
+      gtkdisplay_image[y][x] = colours[0];
 
   image_width = width; image_height = height;
   image_scale = width / DISPLAY_ASPECT_WIDTH;
@@ -177,6 +189,16 @@ uidisplay_init( int width, int height )
 void
 uidisplay_frame_end( void )
 {
+  const libspectrum_dword *wanted;
+
+  /* Pick up the black and white TV setting being changed; everything on
+     screen was drawn in the old colours, so draw it all again */
+  wanted = settings_current.bw_tv ? bw_colours : gtkdisplay_colours;
+  if( wanted != colours ) {
+    colours = wanted;
+    display_refresh_all();
+  }
+
 #if GTK_CHECK_VERSION( 3, 0, 0 )
   if( display_updated ) {
     gdk_window_process_updates( gtk_widget_get_window( gtkui_drawing_area ),
@@ -188,13 +210,35 @@ uidisplay_frame_end( void )
   return;
 }
 
+/* Invalidate the part of the drawing area showing the given part of the
+   image. The drawing area shows the image stretched to fit, and the
+   smoothing used when stretching reaches one image pixel past each edge
+   of the area, so include that too */
 void
 uidisplay_area( int x, int y, int w, int h )
 {
-	int width = gtk_widget_get_allocated_width(gtkui_window);
-	int height = gtk_widget_get_allocated_height(gtkui_window);
+  int width, height, area_width, area_height, x0, y0, x1, y1;
+
+  if( !gtkui_drawing_area ) return;
+
+  width = gtk_widget_get_allocated_width( gtkui_drawing_area );
+  height = gtk_widget_get_allocated_height( gtkui_drawing_area );
+
+  /* On a Timex the image, and so the coordinates we're given, are twice
+     the size in each direction, and the whole doubled image is shown */
+  area_width = DISPLAY_ASPECT_WIDTH;
+  area_height = DISPLAY_SCREEN_HEIGHT;
+  if( machine_current->timex ) {
+    area_width *= 2;
+    area_height *= 2;
+  }
+
+  x0 = ( x - 1 ) * width / area_width;
+  y0 = ( y - 1 ) * height / area_height;
+  x1 = ( ( x + w + 1 ) * width + area_width - 1 ) / area_width;
+  y1 = ( ( y + h + 1 ) * height + area_height - 1 ) / area_height;
 
-	gtk_widget_queue_draw_area( gtkui_drawing_area, 0, 0, width, height );
+  gtk_widget_queue_draw_area( gtkui_drawing_area, x0, y0, x1 - x0, y1 - y0 );
 }
 
 int
@@ -220,17 +264,45 @@ uidisplay_end( void )
 void
 uidisplay_putpixel( int x, int y, int colour )
 {
+  libspectrum_dword rgb = colours[ colour ];
+
   if( machine_current->timex ) {
     x <<= 1; y <<= 1;
-    gtkdisplay_image[y  ][x  ] = colour;
-    gtkdisplay_image[y  ][x+1] = colour;
-    gtkdisplay_image[y+1][x  ] = colour;
-    gtkdisplay_image[y+1][x+1] = colour;
+    gtkdisplay_image[y  ][x  ] = rgb;
+    gtkdisplay_image[y  ][x+1] = rgb;
+    gtkdisplay_image[y+1][x  ] = rgb;
+    gtkdisplay_image[y+1][x+1] = rgb;
   } else {
-    gtkdisplay_image[y][x] = colour;
+    gtkdisplay_image[y][x] = rgb;
   }
 }
 
+/* Write the 8 pixels of `data' to `dest', picking each from `ink' or
+   `paper' without branching */
+static inline void
+plot_chunk( libspectrum_dword *dest, libspectrum_byte data,
+            libspectrum_dword ink, libspectrum_dword paper )
+{
+  const libspectrum_dword *mask = expand_mask[ data ];
+  libspectrum_dword diff = ink ^ paper;
+  int i;
+
+  for( i = 0; i < 8; i++ ) dest[i] = paper ^ ( diff & mask[i] );
+}
+
+/* The same, but with every pixel doubled horizontally */
+static inline void
+plot_chunk_double( libspectrum_dword *dest, libspectrum_byte data,
+                   libspectrum_dword ink, libspectrum_dword paper )
+{
+  const libspectrum_dword *mask = expand_mask[ data ];
+  libspectrum_dword diff = ink ^ paper;
+  int i;
+
+  for( i = 0; i < 8; i++ )
+    dest[ 2 * i ] = dest[ 2 * i + 1 ] = paper ^ ( diff & mask[i] );
+}
+
 /* Print the 8 pixels in `data' using ink colour `ink' and paper
    colour `paper' to the screen at ( (8*x) , y ) */
 void
@@ -240,36 +312,14 @@ uidisplay_plot8( int x, int y, libspectrum_byte data,
   x <<= 3;
 
   if( machine_current->timex ) {
-    int i;
-
     x <<= 1; y <<= 1;
-    for( i=0; i<2; i++,y++ ) {
-      gtkdisplay_image[y][x+ 0] = ( data & 0x80 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 1] = ( data & 0x80 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 2] = ( data & 0x40 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 3] = ( data & 0x40 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 4] = ( data & 0x20 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 5] = ( data & 0x20 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 6] = ( data & 0x10 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 7] = ( data & 0x10 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 8] = ( data & 0x08 ) ? ink : paper;
-      gtkdisplay_image[y][x+ 9] = ( data & 0x08 ) ? ink : paper;
-      gtkdisplay_image[y][x+10] = ( data & 0x04 ) ? ink : paper;
-      gtkdisplay_image[y][x+11] = ( data & 0x04 ) ? ink : paper;
-      gtkdisplay_image[y][x+12] = ( data & 0x02 ) ? ink : paper;
-      gtkdisplay_image[y][x+13] = ( data & 0x02 ) ? ink : paper;
-      gtkdisplay_image[y][x+14] = ( data & 0x01 ) ? ink : paper;
-      gtkdisplay_image[y][x+15] = ( data & 0x01 ) ? ink : paper;
-    }
+    plot_chunk_double( &gtkdisplay_image[y  ][x], data, colours[ ink ],
+                       colours[ paper ] );
+    plot_chunk_double( &gtkdisplay_image[y+1][x], data, colours[ ink ],
+                       colours[ paper ] );
   } else {
-    gtkdisplay_image[y][x+ 0] = ( data & 0x80 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 1] = ( data & 0x40 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 2] = ( data & 0x20 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 3] = ( data & 0x10 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 4] = ( data & 0x08 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 5] = ( data & 0x04 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 6] = ( data & 0x02 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 7] = ( data & 0x01 ) ? ink : paper;
+    plot_chunk( &gtkdisplay_image[y][x], data, colours[ ink ],
+                colours[ paper ] );
   }
 }
 
@@ -283,22 +333,9 @@ uidisplay_plot16( int x, int y, libspectrum_word data,
   x <<= 4; y <<= 1;
 
   for( i=0; i<2; i++,y++ ) {
-    gtkdisplay_image[y][x+ 0] = ( data & 0x8000 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 1] = ( data & 0x4000 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 2] = ( data & 0x2000 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 3] = ( data & 0x1000 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 4] = ( data & 0x0800 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 5] = ( data & 0x0400 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 6] = ( data & 0x0200 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 7] = ( data & 0x0100 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 8] = ( data & 0x0080 ) ? ink : paper;
-    gtkdisplay_image[y][x+ 9] = ( data & 0x0040 ) ? ink : paper;
-    gtkdisplay_image[y][x+10] = ( data & 0x0020 ) ? ink : paper;
-    gtkdisplay_image[y][x+11] = ( data & 0x0010 ) ? ink : paper;
-    gtkdisplay_image[y][x+12] = ( data & 0x0008 ) ? ink : paper;
-    gtkdisplay_image[y][x+13] = ( data & 0x0004 ) ? ink : paper;
-    gtkdisplay_image[y][x+14] = ( data & 0x0002 ) ? ink : paper;
-    gtkdisplay_image[y][x+15] = ( data & 0x0001 ) ? ink : paper;
+    plot_chunk( &gtkdisplay_image[y][x    ], data >> 8, colours[ ink ],
+                colours[ paper ] );
+    plot_chunk( &gtkdisplay_image[y][x + 8], data & 0xff, colours[ ink ],
+                colours[ paper ] );
   }
 }
-
@@ -79,16 +79,21 @@ int memory_current_screen;
 /* Which bits to look at when working out where the screen is */
 libspectrum_word memory_screen_mask;
 
+/* The current epoch, and the epoch each RAM page was last written in */
+libspectrum_dword memory_ram_epoch = 1;
+libspectrum_dword memory_ram_written[ SPECTRUM_RAM_PAGES ];
+
 static void memory_from_snapshot( libspectrum_snap *snap );
-static void memory_to_snapshot( libspectrum_snap *snap );
 
+/* snapshot_copy_to() calls memory_to_snapshot_ex() itself, so it can say
+   whether RAM is to be copied */
 static module_info_t memory_module_info = {
 
   NULL,
   NULL,
   NULL,
   memory_from_snapshot,
-  memory_to_snapshot,
+  NULL,
 
 };
 
@@ -428,10 +433,19 @@ writebyte_internal( libspectrum_word address, libspectrum_byte b )
 
     memory_display_dirty( address, b );
 
+    if( mapping->source == memory_source_ram )
+      memory_ram_set_written( mapping->page_num );
+
     memory[ offset ] = b;
   }
 }
 
+libspectrum_dword
+memory_ram_epoch_next( void )
+{
+  return ++memory_ram_epoch;
+}
+
 void
 memory_romcs_map( void )
 {
@@ -482,8 +496,10 @@ memory_from_snapshot( libspectrum_snap *snap )
   }
 
   for( i = 0; i < 64; i++ )
-    if( libspectrum_snap_pages( snap, i ) )
+    if( libspectrum_snap_pages( snap, i ) ) {
       memcpy( RAM[i], libspectrum_snap_pages( snap, i ), 0x4000 );
+      memory_ram_set_written( i );
+    }
 
   if( libspectrum_snap_custom_rom( snap ) ) {
     for( i = 0; i < libspectrum_snap_custom_rom_pages( snap ) && i < 4; i++ ) {
@@ -574,8 +590,8 @@ memory_rom_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_custom_rom_pages( snap, current_rom_num );
 }
 
-static void
-memory_to_snapshot( libspectrum_snap *snap )
+void
+memory_to_snapshot_ex( libspectrum_snap *snap, int borrow )
 {
   size_t i;
   libspectrum_byte *buffer;
@@ -588,6 +604,11 @@ memory_to_snapshot( libspectrum_snap *snap )
   for( i = 0; i < 64; i++ ) {
     if( RAM[i] != NULL ) {
 
+      if( borrow ) {
+        libspectrum_snap_set_pages( snap, i, RAM[i] );
+        continue;
+      }
+
       buffer = libspectrum_malloc( 0x4000 * sizeof( libspectrum_byte ) );
 
       memcpy( buffer, RAM[i], 0x4000 );
@@ -597,3 +618,84 @@ memory_to_snapshot( libspectrum_snap *snap )
 
   memory_rom_to_snapshot( snap );
 }
+
+void
+memory_snapshot_unborrow( libspectrum_snap *snap )
+{
+  size_t i;
+
+  for( i = 0; i < 64; i++ )
+    if( libspectrum_snap_pages( snap, i ) == RAM[i] )
+      libspectrum_snap_set_pages( snap, i, NULL );
+}
+
+size_t
+memory_ram_pages( void )
+{
+  size_t pages = machine_current->ram.valid_pages;
+
+  /* The 16K and 48K machines count only the pages they use, but those are
+     spread across the first eight */
+  if( pages < 8 ) pages = 8;
+  if( pages > SPECTRUM_RAM_PAGES ) pages = SPECTRUM_RAM_PAGES;
+
+  return pages;
+}
+
+memory_ram_capture_t*
+memory_ram_capture( const memory_ram_capture_t *base, size_t pages )
+{
+  memory_ram_capture_t *capture;
+  memory_ram_copy_t *copy;
+  size_t i;
+
+  capture = libspectrum_malloc( sizeof( *capture ) );
+  memset( capture->pages, 0, sizeof( capture->pages ) );
+
+  for( i = 0; i < pages; i++ ) {
+
+    if( base && base->pages[i] && memory_ram_written[i] < base->epoch ) {
+      copy = base->pages[i];
+      copy->refcount++;
+    } else {
+      copy = libspectrum_malloc( sizeof( *copy ) );
+      memcpy( copy->data, RAM[i], 0x4000 );
+      copy->refcount = 1;
+    }
+
+    capture->pages[i] = copy;
+  }
+
+  capture->epoch = memory_ram_epoch_next();
+
+  return capture;
+}
+
+void
+memory_ram_restore( memory_ram_capture_t *capture )
+{
+  size_t i;
+
+  for( i = 0; i < SPECTRUM_RAM_PAGES; i++ )
+    if( capture->pages[i] ) {
+      memcpy( RAM[i], capture->pages[i]->data, 0x4000 );
+      memory_ram_set_written( i );
+    }
+
+  /* RAM now matches the capture again */
+  capture->epoch = memory_ram_epoch_next();
+}
+
+void
+memory_ram_capture_free( memory_ram_capture_t *capture )
+{
+  size_t i;
+
+  if( !capture ) return;
+
+  for( i = 0; i < SPECTRUM_RAM_PAGES; i++ )
+    if( capture->pages[i] && !--capture->pages[i]->refcount )
+      libspectrum_free( capture->pages[i] );
+
+  libspectrum_free( capture );
+}
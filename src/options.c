@@ -26,25 +26,15 @@
 
 #include <config.h>
 
-#ifdef UI_GTK                /* Use this file if we're using GTK+ */
-
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include <gdk/gdkkeysyms.h>
-#include <gtk/gtk.h>
+#include <glib.h>
 
-#include "compat.h"
-#include "display.h"
-#include "fuse.h"
-#include "gtkcompat.h"
-#include "gtkinternals.h"
 #include "options.h"
-#include "options_internals.h"
-#include "periph.h"
 #include "settings.h"
-#include "utils.h"
+
+/* The combo box options and their enumerations are wanted by the
+   emulation core whatever the UI, so only the dialogs are GTK+ specific */
 
 static int
 option_enumerate_combo( const char **options, char *value, guint count,
@@ -60,6 +50,23 @@ option_enumerate_combo( const char **options, char *value, guint count,
   return def;
 }
 
+#ifdef UI_GTK                /* Use this file if we're using GTK+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gdk/gdkkeysyms.h>
+#include <gtk/gtk.h>
+
+#include "compat.h"
+#include "display.h"
+#include "fuse.h"
+#include "gtkcompat.h"
+#include "gtkinternals.h"
+#include "options_internals.h"
+#include "periph.h"
+#include "utils.h"
+
 static void menu_options_general_done( GtkWidget *widget,
 					  gpointer user_data );
 
@@ -808,6 +815,8 @@ menu_options_rzx_done( GtkWidget *widget GCC_UNUSED,
 }
 
 
+#endif			/* #ifdef UI_GTK */
+
 static const char *sound_stereo_ay_combo[] = {
   "None",
   "ACB",
@@ -843,6 +852,8 @@ option_enumerate_sound_speaker_type( void )
                                  0 );
 }
 
+#ifdef UI_GTK
+
 static void menu_options_sound_done( GtkWidget *widget,
 					  gpointer user_data );
 
@@ -1056,6 +1067,8 @@ menu_options_sound_done( GtkWidget *widget GCC_UNUSED,
 }
 
 
+#endif			/* #ifdef UI_GTK */
+
 static const char *diskoptions_drive_plus3a_type_combo[] = {
   "Single-sided 40 track",
   "Double-sided 40 track",
@@ -1232,6 +1245,8 @@ option_enumerate_diskoptions_disk_try_merge( void )
                                  1 );
 }
 
+#ifdef UI_GTK
+
 static void menu_options_diskoptions_done( GtkWidget *widget,
 					  gpointer user_data );
 
@@ -1713,6 +1728,8 @@ menu_options_diskoptions_done( GtkWidget *widget GCC_UNUSED,
 }
 
 
+#endif			/* #ifdef UI_GTK */
+
 static const char *movie_movie_compr_combo[] = {
   "None",
   "Lossless",
@@ -1730,6 +1747,8 @@ option_enumerate_movie_movie_compr( void )
                                  1 );
 }
 
+#ifdef UI_GTK
+
 static void menu_options_movie_done( GtkWidget *widget,
 					  gpointer user_data );
 
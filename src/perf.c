@@ -0,0 +1,230 @@
+/* perf.c: Host-side timing of the emulator's phases
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Times how long the host spends in each part of the emulator every
+   frame, so that a slow frame can be put down to the Z80 core, the
+   display, sound or the UI rather than just showing up as a lower speed
+   percentage. Switching phase reads the monotonic clock and charges the
+   time since the last switch to the phase being left; nothing is done at
+   all unless timing is on. */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libspectrum.h>
+
+#include "perf.h"
+
+int perf_active = 0;
+
+/* Frames kept for the statistics, and between reports: 5 seconds */
+#define PERF_WINDOW 250
+
+static const char * const phase_names[ PERF_PHASES ] = {
+  "other", "z80", "events", "display", "sound", "ay", "paint",
+};
+
+static const char * const counter_names[ PERF_COUNTERS ] = {
+  "ay log",
+};
+
+static perf_output output;
+
+static perf_phase current;
+static libspectrum_qword last_switch;
+
+/* Nanoseconds spent in each phase so far this frame */
+static libspectrum_qword frame_ns[ PERF_PHASES ];
+
+/* And in each of the last PERF_WINDOW frames */
+static libspectrum_dword window[ PERF_PHASES ][ PERF_WINDOW ];
+static size_t frames;
+
+/* This frame's counts, and the last PERF_WINDOW frames' */
+libspectrum_dword perf_counts[ PERF_COUNTERS ];
+static libspectrum_dword counter_window[ PERF_COUNTERS ][ PERF_WINDOW ];
+
+typedef struct perf_stats {
+  double min, mean, p99, max;
+} perf_stats;
+
+static libspectrum_qword
+now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (libspectrum_qword)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+perf_start( perf_output new_output )
+{
+  output = new_output;
+
+  memset( frame_ns, 0, sizeof( frame_ns ) );
+  memset( perf_counts, 0, sizeof( perf_counts ) );
+  frames = 0;
+
+  current = PERF_PHASE_OTHER;
+  last_switch = now();
+
+  perf_active = 1;
+}
+
+void
+perf_stop( void )
+{
+  perf_active = 0;
+}
+
+perf_phase
+perf_switch( perf_phase phase )
+{
+  libspectrum_qword time = now();
+  perf_phase previous = current;
+
+  frame_ns[ current ] += time - last_switch;
+  last_switch = time;
+  current = phase;
+
+  return previous;
+}
+
+static int
+compare_dword( const void *a, const void *b )
+{
+  libspectrum_dword x = *(const libspectrum_dword*)a,
+    y = *(const libspectrum_dword*)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Over the frames in the window, divided by 'scale' */
+static void
+window_stats( const libspectrum_dword *values, double scale,
+              perf_stats *stats )
+{
+  libspectrum_dword sorted[ PERF_WINDOW ];
+  size_t i, n = frames < PERF_WINDOW ? frames : PERF_WINDOW;
+  double total = 0;
+
+  if( !n ) {
+    stats->min = stats->mean = stats->p99 = stats->max = 0;
+    return;
+  }
+
+  memcpy( sorted, values, n * sizeof( *sorted ) );
+  qsort( sorted, n, sizeof( *sorted ), compare_dword );
+
+  for( i = 0; i < n; i++ ) total += sorted[i];
+
+  stats->min = sorted[0] / scale;
+  stats->mean = total / n / scale;
+  stats->p99 = sorted[ ( n * 99 ) / 100 < n ? ( n * 99 ) / 100 : n - 1 ] /
+               scale;
+  stats->max = sorted[ n - 1 ] / scale;
+}
+
+/* In microseconds */
+static void
+phase_stats( perf_phase phase, perf_stats *stats )
+{
+  window_stats( window[ phase ], 1000.0, stats );
+}
+
+static void
+report( void )
+{
+  perf_stats stats;
+  size_t i;
+
+  if( output == PERF_OUTPUT_JSON ) fprintf( stderr, "{\"frames\":%lu",
+                                            (unsigned long)frames );
+
+  for( i = 0; i < PERF_PHASES; i++ ) {
+    phase_stats( i, &stats );
+
+    if( output == PERF_OUTPUT_JSON ) {
+      fprintf( stderr, ",\"%s\":{\"min\":%.1f,\"avg\":%.1f,\"p99\":%.1f}",
+               phase_names[i], stats.min, stats.mean, stats.p99 );
+    } else {
+      fprintf( stderr, "perf: %-7s min %8.1f avg %8.1f p99 %8.1f us/frame\n",
+               phase_names[i], stats.min, stats.mean, stats.p99 );
+    }
+  }
+
+  for( i = 0; i < PERF_COUNTERS; i++ ) {
+    window_stats( counter_window[i], 1, &stats );
+
+    if( output == PERF_OUTPUT_JSON ) {
+      fprintf( stderr, ",\"%s\":{\"min\":%.0f,\"avg\":%.1f,\"p99\":%.0f,"
+               "\"max\":%.0f}", counter_names[i], stats.min, stats.mean,
+               stats.p99, stats.max );
+    } else {
+      fprintf( stderr, "perf: %-7s min %8.0f avg %8.1f p99 %8.0f max %8.0f "
+               "per frame\n", counter_names[i], stats.min, stats.mean,
+               stats.p99, stats.max );
+    }
+  }
+
+  if( output == PERF_OUTPUT_JSON ) fprintf( stderr, "}\n" );
+}
+
+void
+perf_frame( void )
+{
+  size_t i, slot;
+
+  /* Charge what's running now to the frame that's ending */
+  perf_switch( current );
+
+  slot = frames % PERF_WINDOW;
+  for( i = 0; i < PERF_PHASES; i++ ) {
+    window[i][ slot ] = frame_ns[i] > 0xffffffff ? 0xffffffff : frame_ns[i];
+    frame_ns[i] = 0;
+  }
+
+  for( i = 0; i < PERF_COUNTERS; i++ ) {
+    counter_window[i][ slot ] = perf_counts[i];
+    perf_counts[i] = 0;
+  }
+
+  frames++;
+
+  if( output != PERF_OUTPUT_NONE && frames % PERF_WINDOW == 0 ) report();
+}
+
+void
+perf_summary( char *buffer, size_t length )
+{
+  perf_stats stats;
+  size_t i, used = 0;
+
+  buffer[0] = '\0';
+
+  for( i = 0; i < PERF_PHASES && used < length; i++ ) {
+    phase_stats( i, &stats );
+    used += snprintf( buffer + used, length - used,
+                      "%-7s %6.0f %6.0f %6.0f\n", phase_names[i],
+                      stats.min, stats.mean, stats.p99 );
+  }
+}
@@ -25,6 +25,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "debugger/debugger.h"
@@ -64,6 +66,25 @@ typedef struct periph_port_private_t {
 /* The list of currently active ports */
 static GSList *ports = NULL;
 
+/* The port responses for each port value, precomputed from `ports'.
+   port_read_table[ port ] and port_write_table[ port ] are offsets into
+   port_handlers, each the start of a NULL-terminated list of the port
+   responses which match that port, in the same order as in `ports'.
+   Port values with the same responses share the same list */
+static libspectrum_dword port_read_table[ 0x10000 ];
+static libspectrum_dword port_write_table[ 0x10000 ];
+static const periph_port_t **port_handlers = NULL;
+static size_t port_handlers_count = 0, port_handlers_size = 0;
+
+/* Set when `ports' has changed since the tables were built */
+static int port_table_dirty = 1;
+
+/* How many port reads and writes are working through port_handlers. A
+   handler can change the peripherals, and rebuilding the tables then
+   would move port_handlers under the dispatch loop, so the rebuild waits
+   until the next read or write after dispatch has finished */
+static int port_dispatching = 0;
+
 /* The strings used for debugger events */
 static const char *page_event_string = "page",
   *unpage_event_string = "unpage";
@@ -80,6 +101,7 @@ port_register( periph_type type, const periph_port_t *port )
   private->port = *port;
 
   ports = g_slist_append( ports, private );
+  port_table_dirty = 1;
 }
 
 /* Register a peripheral with the system */
@@ -134,6 +156,7 @@ periph_activate_type( periph_type type, int active )
     GSList *found;
     while( ( found = g_slist_find_custom( ports, GINT_TO_POINTER( type ), find_by_type ) ) != NULL )
       ports = g_slist_remove( ports, found->data );
+    port_table_dirty = 1;
   }
 
   return 1;
@@ -222,6 +245,7 @@ periph_clear( void )
   g_slist_foreach( ports, free_peripheral, NULL );
   g_slist_free( ports );
   ports = NULL;
+  port_table_dirty = 1;
   set_types_inactive();
 }
 
@@ -232,23 +256,126 @@ periph_end( void )
   g_slist_foreach( ports, free_peripheral, NULL );
   g_slist_free( ports );
   ports = NULL;
+  port_table_dirty = 1;
+
+  libspectrum_free( port_handlers );
+  port_handlers = NULL;
+  port_handlers_count = port_handlers_size = 0;
 
   g_hash_table_destroy( peripherals );
   peripherals = NULL;
 }
 
 /*
- * The actual routines to read and write a port
+ * The port dispatch tables
  */
 
-/* Internal type used for passing to read_peripheral and write_peripheral */
-struct peripheral_data_t {
+/* Are the first `length' entries of `list' the whole of the handler list
+   starting at `offset'? */
+static int
+port_list_matches( libspectrum_dword offset, const periph_port_t **list,
+                   size_t length )
+{
+  size_t i;
 
-  libspectrum_word port;
+  for( i = 0; i < length; i++ )
+    if( port_handlers[ offset + i ] != list[i] ) return 0;
 
-  int attached;
-  libspectrum_byte value;
-};
+  return port_handlers[ offset + length ] == NULL;
+}
+
+/* Get the offset of a handler list with the given contents, adding it to
+   port_handlers if it's not already there */
+static libspectrum_dword
+port_list_find( GArray *lists, const periph_port_t **list, size_t length )
+{
+  libspectrum_dword offset;
+  size_t i;
+
+  for( i = 0; i < lists->len; i++ ) {
+    offset = g_array_index( lists, libspectrum_dword, i );
+    if( port_list_matches( offset, list, length ) ) return offset;
+  }
+
+  if( port_handlers_count + length + 1 > port_handlers_size ) {
+    while( port_handlers_count + length + 1 > port_handlers_size )
+      port_handlers_size = port_handlers_size ? 2 * port_handlers_size : 64;
+    port_handlers = libspectrum_realloc( port_handlers, port_handlers_size *
+                                                        sizeof( *port_handlers ) );
+  }
+
+  offset = port_handlers_count;
+  for( i = 0; i < length; i++ ) port_handlers[ port_handlers_count++ ] = list[i];
+  port_handlers[ port_handlers_count++ ] = NULL;
+
+  g_array_append_val( lists, offset );
+
+  return offset;
+}
+
+/* Rebuild the dispatch tables from the list of active ports */
+static void
+port_table_build( void )
+{
+  GArray *lists;
+  GSList *ptr;
+  const periph_port_t **read, **write, **last_read, **last_write, **swap;
+  size_t count, read_count, write_count, last_read_count, last_write_count;
+  int port;
+
+  count = g_slist_length( ports );
+  read = libspectrum_malloc( ( count + 1 ) * sizeof( *read ) );
+  write = libspectrum_malloc( ( count + 1 ) * sizeof( *write ) );
+  last_read = libspectrum_malloc( ( count + 1 ) * sizeof( *last_read ) );
+  last_write = libspectrum_malloc( ( count + 1 ) * sizeof( *last_write ) );
+  last_read_count = last_write_count = 0;
+
+  lists = g_array_new( FALSE, FALSE, sizeof( libspectrum_dword ) );
+  port_handlers_count = 0;
+
+  for( port = 0; port < 0x10000; port++ ) {
+
+    read_count = write_count = 0;
+    for( ptr = ports; ptr; ptr = ptr->next ) {
+      const periph_port_t *response =
+        &( ( (periph_port_private_t*)ptr->data )->port );
+
+      if( ( port & response->mask ) != response->value ) continue;
+
+      if( response->read ) read[ read_count++ ] = response;
+      if( response->write ) write[ write_count++ ] = response;
+    }
+
+    /* Neighbouring ports usually decode the same way, so check the last
+       list before searching all of them */
+    if( port && read_count == last_read_count &&
+        !memcmp( read, last_read, read_count * sizeof( *read ) ) )
+      port_read_table[ port ] = port_read_table[ port - 1 ];
+    else
+      port_read_table[ port ] = port_list_find( lists, read, read_count );
+
+    if( port && write_count == last_write_count &&
+        !memcmp( write, last_write, write_count * sizeof( *write ) ) )
+      port_write_table[ port ] = port_write_table[ port - 1 ];
+    else
+      port_write_table[ port ] = port_list_find( lists, write, write_count );
+
+    swap = last_read; last_read = read; read = swap;
+    last_read_count = read_count;
+    swap = last_write; last_write = write; write = swap;
+    last_write_count = write_count;
+  }
+
+  g_array_free( lists, TRUE );
+  libspectrum_free( read ); libspectrum_free( write );
+  libspectrum_free( last_read ); libspectrum_free( last_write );
+
+  port_table_dirty = 0;
+}
+
+/*
+ * The actual routines to read and write a port
+ */
 
 /* Read a byte from a port, taking the appropriate time */
 libspectrum_byte
@@ -272,27 +399,13 @@ readport( libspectrum_word port )
   return b;
 }
 
-/* Read a byte from a specific port response */
-static void
-read_peripheral( gpointer data, gpointer user_data )
-{
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
-
-  periph_port_t *port = &( private->port );
-
-  if( port->read &&
-      ( ( callback_info->port & port->mask ) == port->value ) ) {
-    callback_info->value &= port->read( callback_info->port,
-					&( callback_info->attached ) );
-  }
-}
-
 /* Read a byte from a port, taking no time */
 libspectrum_byte
 readport_internal( libspectrum_word port )
 {
-  struct peripheral_data_t callback_info;
+  libspectrum_dword i;
+  libspectrum_byte value;
+  int attached;
 
   /* Trigger the debugger if wanted */
   if( debugger_mode != DEBUGGER_MODE_INACTIVE )
@@ -318,19 +431,23 @@ readport_internal( libspectrum_word port )
   }
 
   /* If we're not doing RZX playback, get the byte normally */
-  callback_info.port = port;
-  callback_info.attached = 0;
-  callback_info.value = 0xff;
+  if( port_table_dirty && !port_dispatching ) port_table_build();
+
+  attached = 0;
+  value = 0xff;
 
-  g_slist_foreach( ports, read_peripheral, &callback_info );
+  port_dispatching++;
+  for( i = port_read_table[ port ]; port_handlers[i]; i++ )
+    value &= port_handlers[i]->read( port, &attached );
+  port_dispatching--;
 
-  if( !callback_info.attached )
-    callback_info.value = machine_current->unattached_port();
+  if( !attached )
+    value = machine_current->unattached_port();
 
   /* If we're RZX recording, store this byte */
-  if( rzx_recording ) rzx_store_byte( callback_info.value );
+  if( rzx_recording ) rzx_store_byte( value );
 
-  return callback_info.value;
+  return value;
 }
 
 /* Write a byte to a port, taking the appropriate time */
@@ -342,34 +459,22 @@ writeport( libspectrum_word port, libspectrum_byte b )
   ula_contend_port_late( port ); tstates++;
 }
 
-/* Write a byte to a specific port response */
-static void
-write_peripheral( gpointer data, gpointer user_data )
-{
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
-
-  periph_port_t *port = &( private->port );
-  
-  if( port->write &&
-      ( ( callback_info->port & port->mask ) == port->value ) )
-    port->write( callback_info->port, callback_info->value );
-}
-
 /* Write a byte to a port, taking no time */
 void
 writeport_internal( libspectrum_word port, libspectrum_byte b )
 {
-  struct peripheral_data_t callback_info;
+  libspectrum_dword i;
 
   /* Trigger the debugger if wanted */
   if( debugger_mode != DEBUGGER_MODE_INACTIVE )
     debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE, port );
 
-  callback_info.port = port;
-  callback_info.value = b;
-  
-  g_slist_foreach( ports, write_peripheral, &callback_info );
+  if( port_table_dirty && !port_dispatching ) port_table_build();
+
+  port_dispatching++;
+  for( i = port_write_table[ port ]; port_handlers[i]; i++ )
+    port_handlers[i]->write( port, b );
+  port_dispatching--;
 }
 
 /*
@@ -437,6 +542,8 @@ periph_update( void )
   specplus3_765_update_fdd();
   machine_current->memory_map();
 
+  if( port_table_dirty && !port_dispatching ) port_table_build();
+
   return needs_hard_reset;
 }
 
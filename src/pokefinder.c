@@ -23,10 +23,25 @@
 
 */
 
+/* Each pass over RAM looks at 16 locations at a time: the test is done
+   with SSE2 or NEON compares where available, giving a bit per location
+   which failed it, and those bits are ORed straight into the 'impossible'
+   bitmap. Pages with no possible locations left are skipped altogether,
+   and when there are a lot of pages still to look at, they are shared
+   out between threads. */
+
 #include <config.h>
 
 #include <string.h>
 
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#define POKEFINDER_NEON 1
+#endif
+
+#include <glib.h>
 #include <libspectrum.h>
 
 #include "machine.h"
@@ -34,91 +49,316 @@
 #include "pokefinder.h"
 #include "spectrum.h"
 
-libspectrum_byte pokefinder_possible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE ];
-libspectrum_byte pokefinder_impossible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE / 8 ];
+#define POKEFINDER_PAGES ( MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES )
+
+/* Locations looked at together */
+#define BLOCK 16
+
+/* Don't bother with threads for fewer pages than this: 256K */
+#define THREAD_MIN_PAGES 64
+
+/* Nor more threads than this */
+#define MAX_THREADS 8
+
+libspectrum_byte pokefinder_possible[ POKEFINDER_PAGES ][ MEMORY_PAGE_SIZE ];
+libspectrum_byte pokefinder_impossible[ POKEFINDER_PAGES ][ MEMORY_PAGE_SIZE / 8 ];
 size_t pokefinder_count;
 
-void
-pokefinder_clear( void )
+/* The number of possible locations left in each page */
+static size_t live[ POKEFINDER_PAGES ];
+
+typedef enum pass_type {
+  PASS_SEARCH,
+  PASS_INCREMENTED,
+  PASS_DECREMENTED,
+} pass_type;
+
+/* One pass over RAM, or the part of it one thread does */
+typedef struct pass_t {
+
+  pass_type type;
+  int word;			/* Looking at 16 bit little endian values */
+
+  /* The value searched for, each byte repeated BLOCK times */
+  libspectrum_byte low[ BLOCK ], high[ BLOCK ];
+
+  size_t first, step;		/* The pages to look at */
+  size_t removed;		/* Locations found to be impossible */
+
+} pass_t;
+
+/* A bit for each of the BLOCK bytes at 'a' which is equal to that at 'b',
+   and for each which is less than or equal to it */
+#if defined( __SSE2__ )
+
+static inline libspectrum_word
+mask_eq( const libspectrum_byte *a, const libspectrum_byte *b )
 {
-  size_t page, max_page;
+  return _mm_movemask_epi8(
+    _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)a ),
+                    _mm_loadu_si128( (const __m128i*)b ) ) );
+}
 
-  max_page = MEMORY_PAGES_IN_16K * machine_current->ram.valid_pages;
-  pokefinder_count = 0;
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; ++page )
-    if( memory_map_ram[page].writable && page < max_page ) {
-      pokefinder_count += MEMORY_PAGE_SIZE;
-      memcpy( pokefinder_possible[page], memory_map_ram[page].page, MEMORY_PAGE_SIZE );
-      memset( pokefinder_impossible[page], 0, MEMORY_PAGE_SIZE / 8 );
-    } else
-      memset( pokefinder_impossible[page], 255, MEMORY_PAGE_SIZE / 8 );
+static inline libspectrum_word
+mask_le( const libspectrum_byte *a, const libspectrum_byte *b )
+{
+  __m128i x = _mm_loadu_si128( (const __m128i*)a ),
+    y = _mm_loadu_si128( (const __m128i*)b );
+
+  /* There's no unsigned compare, but a <= b exactly when max( a, b ) == b */
+  return _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( x, y ), y ) );
 }
 
-int
-pokefinder_search( libspectrum_byte value )
+#elif defined( POKEFINDER_NEON )
+
+static inline libspectrum_word
+neon_mask( uint8x16_t lanes )
+{
+  static const libspectrum_byte bits[ BLOCK ] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t set = vandq_u8( lanes, vld1q_u8( bits ) );
+
+  return vaddv_u8( vget_low_u8( set ) ) | vaddv_u8( vget_high_u8( set ) ) << 8;
+}
+
+static inline libspectrum_word
+mask_eq( const libspectrum_byte *a, const libspectrum_byte *b )
 {
-  size_t page, offset;
+  return neon_mask( vceqq_u8( vld1q_u8( a ), vld1q_u8( b ) ) );
+}
 
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+static inline libspectrum_word
+mask_le( const libspectrum_byte *a, const libspectrum_byte *b )
+{
+  return neon_mask( vcleq_u8( vld1q_u8( a ), vld1q_u8( b ) ) );
+}
 
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+#else				/* #if defined( __SSE2__ ) */
+
+static inline libspectrum_word
+mask_eq( const libspectrum_byte *a, const libspectrum_byte *b )
+{
+  libspectrum_word mask = 0;
+  size_t i;
+
+  for( i = 0; i < BLOCK; i++ ) if( a[i] == b[i] ) mask |= 1 << i;
+
+  return mask;
+}
+
+static inline libspectrum_word
+mask_le( const libspectrum_byte *a, const libspectrum_byte *b )
+{
+  libspectrum_word mask = 0;
+  size_t i;
+
+  for( i = 0; i < BLOCK; i++ ) if( a[i] <= b[i] ) mask |= 1 << i;
+
+  return mask;
+}
+
+#endif				/* #if defined( __SSE2__ ) */
+
+/* Which of the BLOCK locations starting at 'now' fail the test, given
+   their values at the last pass in 'then'; for 16 bit values, the byte
+   after each block must be readable too */
+static inline libspectrum_word
+block_fails( const pass_t *pass, const libspectrum_byte *now,
+             const libspectrum_byte *then )
+{
+  switch( pass->type ) {
+
+  case PASS_SEARCH:
+    if( !pass->word ) return ~mask_eq( now, pass->low );
+    return ~( mask_eq( now, pass->low ) & mask_eq( now + 1, pass->high ) );
+
+  case PASS_INCREMENTED:
+    if( !pass->word ) return mask_le( now, then );
+    return mask_le( now + 1, then + 1 ) &
+           ( ~mask_eq( now + 1, then + 1 ) | mask_le( now, then ) );
+
+  case PASS_DECREMENTED:
+    if( !pass->word ) return mask_le( then, now );
+    return mask_le( then + 1, now + 1 ) &
+           ( ~mask_eq( now + 1, then + 1 ) | mask_le( then, now ) );
 
-      if( mapping->page[offset] != value ) {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
-    }
   }
 
   return 0;
 }
 
-int
-pokefinder_incremented( void )
+/* Mark anything in 'page' which fails the test as impossible; returns how
+   many locations that was */
+static size_t
+pass_page( const pass_t *pass, size_t page )
 {
-  size_t page, offset;
+  libspectrum_byte now_buffer[ MEMORY_PAGE_SIZE + 1 ],
+    then_buffer[ MEMORY_PAGE_SIZE + 1 ];
+  const libspectrum_byte *now = memory_map_ram[ page ].page,
+    *then = pokefinder_possible[ page ];
+  libspectrum_byte *impossible = pokefinder_impossible[ page ];
+  libspectrum_word was, fails;
+  size_t offset, removed = 0;
 
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+  if( pass->word ) {
 
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+    /* Values which start at the end of the page finish in the next one */
+    memcpy( now_buffer, now, MEMORY_PAGE_SIZE );
+    memcpy( then_buffer, then, MEMORY_PAGE_SIZE );
+    now = now_buffer; then = then_buffer;
 
-      if( mapping->page[offset] > pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
-      } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
+    if( ( page + 1 ) % MEMORY_PAGES_IN_16K ) {
+      now_buffer[ MEMORY_PAGE_SIZE ] = memory_map_ram[ page + 1 ].page[0];
+      then_buffer[ MEMORY_PAGE_SIZE ] = pokefinder_possible[ page + 1 ][0];
+    } else {
 
+      /* But the next bank isn't necessarily next in memory, so nothing
+         can start at the end of a bank */
+      now_buffer[ MEMORY_PAGE_SIZE ] = then_buffer[ MEMORY_PAGE_SIZE ] = 0;
+      if( !( impossible[ MEMORY_PAGE_SIZE / 8 - 1 ] & 0x80 ) ) {
+        impossible[ MEMORY_PAGE_SIZE / 8 - 1 ] |= 0x80;
+        removed++;
+      }
     }
   }
 
-  return 0;
+  for( offset = 0; offset < MEMORY_PAGE_SIZE; offset += BLOCK ) {
+    was = impossible[ offset / 8 ] | impossible[ offset / 8 + 1 ] << 8;
+    if( was == 0xffff ) continue;
+
+    fails = block_fails( pass, now + offset, then + offset ) & ~was;
+    if( !fails ) continue;
+
+    was |= fails;
+    impossible[ offset / 8 ] = was & 0xff;
+    impossible[ offset / 8 + 1 ] = was >> 8;
+
+    for( ; fails; fails &= fails - 1 ) removed++;
+  }
+
+  return removed;
 }
 
-int
-pokefinder_decremented( void )
+static gpointer
+pass_thread( gpointer data )
 {
-  size_t page, offset;
+  pass_t *pass = data;
+  size_t page, removed;
 
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+  for( page = pass->first; page < POKEFINDER_PAGES; page += pass->step ) {
+    if( !live[ page ] ) continue;
 
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+    removed = pass_page( pass, page );
+    live[ page ] -= removed;
+    pass->removed += removed;
+  }
 
-      if( mapping->page[offset] < pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
-      } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
+  return NULL;
+}
+
+static int
+pass_run( pass_type type, int word, libspectrum_word value )
+{
+  pass_t passes[ MAX_THREADS ];
+  GThread *threads[ MAX_THREADS ];
+  size_t page, live_pages = 0, nthreads = 1, i;
+
+  for( page = 0; page < POKEFINDER_PAGES; page++ )
+    if( live[ page ] ) live_pages++;
+
+  if( live_pages >= THREAD_MIN_PAGES ) {
+    nthreads = g_get_num_processors();
+    if( nthreads > MAX_THREADS ) nthreads = MAX_THREADS;
+  }
+
+  /* Pages are dealt out in turn, so each thread gets a similar share of
+     the possible locations */
+  for( i = 0; i < nthreads; i++ ) {
+    passes[i].type = type;
+    passes[i].word = word;
+    memset( passes[i].low, value & 0xff, BLOCK );
+    memset( passes[i].high, value >> 8, BLOCK );
+    passes[i].first = i;
+    passes[i].step = nthreads;
+    passes[i].removed = 0;
+  }
+
+  for( i = 1; i < nthreads; i++ )
+    threads[i] = g_thread_new( "pokefinder", pass_thread, &passes[i] );
 
+  pass_thread( &passes[0] );
+
+  for( i = 0; i < nthreads; i++ ) {
+    if( i ) g_thread_join( threads[i] );
+    pokefinder_count -= passes[i].removed;
+  }
+
+  /* Remember the values now for the next comparison, including the first
+     byte of pages which 16 bit values from the page before end in */
+  if( type != PASS_SEARCH ) {
+    for( page = 0; page < POKEFINDER_PAGES; page++ ) {
+      if( live[ page ] ||
+          ( page % MEMORY_PAGES_IN_16K && live[ page - 1 ] ) )
+        memcpy( pokefinder_possible[ page ], memory_map_ram[ page ].page,
+                MEMORY_PAGE_SIZE );
     }
   }
 
   return 0;
 }
+
+void
+pokefinder_clear( void )
+{
+  size_t page, max_page;
+
+  max_page = MEMORY_PAGES_IN_16K * machine_current->ram.valid_pages;
+  pokefinder_count = 0;
+  for( page = 0; page < POKEFINDER_PAGES; ++page )
+    if( memory_map_ram[page].writable && page < max_page ) {
+      pokefinder_count += MEMORY_PAGE_SIZE;
+      live[page] = MEMORY_PAGE_SIZE;
+      memcpy( pokefinder_possible[page], memory_map_ram[page].page, MEMORY_PAGE_SIZE );
+      memset( pokefinder_impossible[page], 0, MEMORY_PAGE_SIZE / 8 );
+    } else {
+      live[page] = 0;
+      memset( pokefinder_impossible[page], 255, MEMORY_PAGE_SIZE / 8 );
+    }
+}
+
+int
+pokefinder_search( libspectrum_byte value )
+{
+  return pass_run( PASS_SEARCH, 0, value );
+}
+
+int
+pokefinder_incremented( void )
+{
+  return pass_run( PASS_INCREMENTED, 0, 0 );
+}
+
+int
+pokefinder_decremented( void )
+{
+  return pass_run( PASS_DECREMENTED, 0, 0 );
+}
+
+int
+pokefinder_search_word( libspectrum_word value )
+{
+  return pass_run( PASS_SEARCH, 1, value );
+}
+
+int
+pokefinder_incremented_word( void )
+{
+  return pass_run( PASS_INCREMENTED, 1, 0 );
+}
+
+int
+pokefinder_decremented_word( void )
+{
+  return pass_run( PASS_DECREMENTED, 1, 0 );
+}
@@ -25,24 +25,73 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <glib.h>
 #include <libspectrum.h>
 
 #include "event.h"
 #include "fuse.h"
+#include "memory.h"
 #include "module.h"
 #include "profile.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
+#include "z80/z80_macros.h"
+
+/* As well as the time spent at each address, the profiler keeps a call
+   graph. Calls (CALL, RST and interrupts) and returns (RET, RETI and
+   RETN) are followed on a shadow stack, and time is charged to the node
+   of a call tree for the current path of routines. A routine is
+   identified by its entry address together with what was paged in
+   there, so the same address in different banks counts separately.
+
+   Games don't always return the way they were called: they discard
+   return addresses, or return to somewhere computed. So a return pops
+   every frame whose return address the stack pointer has moved past,
+   rather than just the top one; and a return which doesn't move past
+   any is taken as a jump. */
 
 int profile_active = 0;
 
-static int total_tstates[ 0x10000 ];
+static libspectrum_qword total_tstates[ 0x10000 ];
 static libspectrum_word profile_last_pc;
 static libspectrum_dword profile_last_tstates;
 
+/* The instruction at profile_last_pc, and SP before it ran */
+static libspectrum_byte profile_last_opcode, profile_last_opcode2;
+static libspectrum_word profile_last_sp;
+
+/* Set when an interrupt has just been accepted, with SP inside it */
+static int interrupt_pending;
+static libspectrum_word interrupt_sp;
+
+typedef struct profile_node {
+
+  /* Which routine: source << 24 | page << 16 | address */
+  libspectrum_dword routine;
+
+  struct profile_node *parent, *child, *sibling;
+
+  libspectrum_qword exclusive, inclusive;
+  libspectrum_dword calls;
+
+} profile_node;
+
+static profile_node *root, *current;
+
+/* The shadow stack: for each call, SP inside the routine, which points
+   at the return address */
+#define MAX_DEPTH 256
+
+static libspectrum_word stack_sp[ MAX_DEPTH ];
+static size_t depth;
+
+/* Calls made while the stack was full; their returns are ignored */
+static size_t overflow;
+
 static void profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED );
 
 static module_info_t profile_module_info = {
@@ -61,11 +110,100 @@ profile_init( void )
   module_register( &profile_module_info );
 }
 
+static libspectrum_dword
+routine_at( libspectrum_word address )
+{
+  memory_page *mapping =
+    &memory_map_read[ address >> MEMORY_PAGE_SIZE_LOGARITHM ];
+
+  return (libspectrum_dword)( mapping->source & 0xff ) << 24 |
+         (libspectrum_dword)( mapping->page_num & 0xff ) << 16 | address;
+}
+
+static void
+node_free( profile_node *node )
+{
+  profile_node *child, *next;
+
+  if( !node ) return;
+
+  for( child = node->child; child; child = next ) {
+    next = child->sibling;
+    node_free( child );
+  }
+
+  libspectrum_free( node );
+}
+
+static profile_node*
+node_new( profile_node *parent, libspectrum_dword routine )
+{
+  profile_node *node = libspectrum_malloc( sizeof( *node ) );
+
+  node->routine = routine;
+  node->parent = parent;
+  node->child = node->sibling = NULL;
+  node->exclusive = node->inclusive = 0;
+  node->calls = 0;
+
+  return node;
+}
+
+static void
+call( libspectrum_word address, libspectrum_word sp )
+{
+  libspectrum_dword routine;
+  profile_node *node, **link;
+
+  if( depth == MAX_DEPTH ) { overflow++; return; }
+
+  routine = routine_at( address );
+
+  /* Find the child for this routine, moving it to the front as it's likely
+     to be called again soon */
+  for( link = &current->child; *link; link = &(*link)->sibling )
+    if( (*link)->routine == routine ) break;
+
+  node = *link;
+  if( node ) {
+    *link = node->sibling;
+  } else {
+    node = node_new( current, routine );
+  }
+  node->sibling = current->child;
+  current->child = node;
+
+  node->calls++;
+  stack_sp[ depth++ ] = sp;
+  current = node;
+}
+
+static void
+ret( libspectrum_word sp )
+{
+  /* A return the stack is overflowed with comes from a call we didn't
+     record */
+  if( overflow ) { overflow--; return; }
+
+  while( depth && sp > stack_sp[ depth - 1 ] ) {
+    depth--;
+    current = current->parent;
+  }
+}
+
 static void
 init_profiling_counters( void )
 {
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
+  profile_last_opcode = readbyte_internal( z80.pc.w );
+  profile_last_opcode2 = readbyte_internal( z80.pc.w + 1 );
+  profile_last_sp = SP;
+  interrupt_pending = 0;
+
+  /* PC and SP have jumped, so the shadow stack means nothing any more */
+  depth = overflow = 0;
+  current = root;
 }
 
 void
@@ -73,6 +211,9 @@ profile_start( void )
 {
   memset( total_tstates, 0, sizeof( total_tstates ) );
 
+  node_free( root );
+  root = node_new( NULL, 0 );
+
   profile_active = 1;
   init_profiling_counters();
 
@@ -87,12 +228,46 @@ profile_start( void )
 void
 profile_map( libspectrum_word pc )
 {
-  if( tstates - profile_last_tstates > 256 ) fuse_abort();
-
-  total_tstates[ profile_last_pc ] += tstates - profile_last_tstates;
+  libspectrum_dword elapsed = tstates - profile_last_tstates;
+  libspectrum_byte opcode = profile_last_opcode;
+
+  /* Anything which takes longer than an instruction (an interrupt being
+     accepted, or a halt being run through) is charged to the last
+     instruction */
+  total_tstates[ profile_last_pc ] += elapsed;
+  current->exclusive += elapsed;
+
+  if( interrupt_pending ) {
+    interrupt_pending = 0;
+    call( z80.pc.w, interrupt_sp );
+  } else if( opcode == 0xcd || ( opcode & 0xc7 ) == 0xc4 ||
+             ( opcode & 0xc7 ) == 0xc7 ) {
+    /* CALL nn, CALL cc,nn or RST; conditional calls only count if taken */
+    if( SP == (libspectrum_word)( profile_last_sp - 2 ) )
+      call( z80.pc.w, SP );
+  } else if( opcode == 0xc9 || ( opcode & 0xc7 ) == 0xc0 ||
+             ( opcode == 0xed && ( profile_last_opcode2 & 0xc7 ) == 0x45 ) ) {
+    /* RET, RET cc, or RETI/RETN */
+    if( SP != profile_last_sp ) ret( SP );
+  }
 
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
+  profile_last_sp = SP;
+  profile_last_opcode = readbyte_internal( z80.pc.w );
+  profile_last_opcode2 = readbyte_internal( z80.pc.w + 1 );
+}
+
+void
+profile_interrupt( void )
+{
+  /* Finish off the instruction before the interrupt, then count the
+     interrupt as a call once we know where it's gone */
+  profile_map( z80.pc.w );
+
+  profile_last_opcode = 0x00;
+  interrupt_pending = 1;
+  interrupt_sp = SP - 2;
 }
 
 void
@@ -109,29 +284,167 @@ profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
   init_profiling_counters();
 }
 
+static void
+routine_name( char *buffer, size_t length, libspectrum_dword routine )
+{
+  snprintf( buffer, length, "%s%d:%04x",
+            memory_source_description( routine >> 24 ),
+            (int)( ( routine >> 16 ) & 0xff ), routine & 0xffff );
+}
+
+static void
+sum_inclusive( profile_node *node )
+{
+  profile_node *child;
+
+  node->inclusive = node->exclusive;
+
+  for( child = node->child; child; child = child->sibling ) {
+    sum_inclusive( child );
+    node->inclusive += child->inclusive;
+  }
+}
+
+/* Write a line of collapsed stacks for every node which spent time in
+   itself: the names of the routines from the top down, separated by
+   semicolons, then the time */
+static void
+write_folded( FILE *f, profile_node *node, char *path, size_t length )
+{
+  profile_node *child;
+  size_t end = strlen( path );
+
+  if( node != root ) {
+    routine_name( path + end, length - end, node->routine );
+    if( node->exclusive )
+      fprintf( f, "%s %llu\n", path, (unsigned long long)node->exclusive );
+    strncat( path, ";", length - strlen( path ) - 1 );
+  } else if( node->exclusive ) {
+    fprintf( f, "top %llu\n", (unsigned long long)node->exclusive );
+  }
+
+  for( child = node->child; child; child = child->sibling )
+    write_folded( f, child, path, length );
+
+  path[ end ] = '\0';
+}
+
+typedef struct routine_totals {
+  libspectrum_qword inclusive, exclusive;
+  libspectrum_dword calls;
+  int active;
+} routine_totals;
+
+/* Total up each routine over every path it was called on. Recursive calls
+   are already inside an outer call's inclusive time, so only the
+   outermost call on each path counts towards that */
+static void
+sum_routines( GHashTable *routines, profile_node *node )
+{
+  routine_totals *totals;
+  profile_node *child;
+
+  totals = g_hash_table_lookup( routines, GUINT_TO_POINTER( node->routine ) );
+  if( !totals ) {
+    totals = libspectrum_malloc( sizeof( *totals ) );
+    memset( totals, 0, sizeof( *totals ) );
+    g_hash_table_insert( routines, GUINT_TO_POINTER( node->routine ),
+                         totals );
+  }
+
+  if( !totals->active ) totals->inclusive += node->inclusive;
+  totals->exclusive += node->exclusive;
+  totals->calls += node->calls;
+
+  totals->active++;
+  for( child = node->child; child; child = child->sibling )
+    sum_routines( routines, child );
+  totals->active--;
+}
+
+static void
+write_routine( gpointer key, gpointer value, gpointer user_data )
+{
+  routine_totals *totals = value;
+  char name[ 64 ];
+
+  routine_name( name, sizeof( name ), GPOINTER_TO_UINT( key ) );
+  fprintf( user_data, "%s,%lu,%llu,%llu\n", name,
+           (unsigned long)totals->calls,
+           (unsigned long long)totals->inclusive,
+           (unsigned long long)totals->exclusive );
+}
+
+static FILE*
+open_output( const char *filename, const char *suffix )
+{
+  char *name;
+  FILE *f;
+
+  name = libspectrum_malloc( strlen( filename ) + strlen( suffix ) + 1 );
+  strcpy( name, filename ); strcat( name, suffix );
+
+  f = fopen( name, "w" );
+  if( !f )
+    ui_error( UI_ERROR_ERROR, "unable to open profile map '%s' for writing",
+	      name );
+
+  libspectrum_free( name );
+
+  return f;
+}
+
+/* Write the time spent at each address to 'filename'; the collapsed
+   stacks, for flame graph tools, to 'filename'.folded; and the calls and
+   inclusive and exclusive time for each routine to 'filename'.routines */
 void
 profile_finish( const char *filename )
 {
   FILE *f;
   size_t i;
+  GHashTable *routines;
+  profile_node *node;
+  char path[ MAX_DEPTH * 20 ];
 
-  f = fopen( filename, "w" );
-  if( !f ) {
-    ui_error( UI_ERROR_ERROR, "unable to open profile map '%s' for writing",
-	      filename );
-    return;
-  }
+  f = open_output( filename, "" );
+  if( !f ) return;
 
   for( i = 0; i < 0x10000; i++ ) {
 
     if( !total_tstates[ i ] ) continue;
 
-    fprintf( f, "0x%04lx,%d\n", (unsigned long)i, total_tstates[ i ] );
+    fprintf( f, "0x%04lx,%llu\n", (unsigned long)i,
+             (unsigned long long)total_tstates[ i ] );
 
   }
 
   fclose( f );
 
+  sum_inclusive( root );
+
+  f = open_output( filename, ".folded" );
+  if( f ) {
+    path[0] = '\0';
+    write_folded( f, root, path, sizeof( path ) );
+    fclose( f );
+  }
+
+  f = open_output( filename, ".routines" );
+  if( f ) {
+    routines = g_hash_table_new_full( NULL, NULL, NULL, libspectrum_free );
+
+    for( node = root->child; node; node = node->sibling )
+      sum_routines( routines, node );
+
+    fprintf( f, "routine,calls,inclusive,exclusive\n" );
+    g_hash_table_foreach( routines, write_routine, f );
+    g_hash_table_destroy( routines );
+
+    fclose( f );
+  }
+
+  node_free( root ); root = current = NULL;
+
   profile_active = 0;
 
   /* Again, schedule an event to ensure this change is picked up by
@@ -0,0 +1,343 @@
+/* rewind.c: In-memory rewind buffer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Keeps the last few seconds of emulation so that it can be stepped back
+   through a frame at a time.
+
+   RAM is the bulk of the machine's state, and very little of it changes
+   from one frame to the next. So rather than a full snapshot per frame,
+   we keep a single capture of RAM as it was at the last frame recorded
+   (the keyframe), and for each frame the bytes which changed in the frame
+   before it, XORed against their old values and run-length encoded.
+   XOR works in both directions, so undoing the newest frame's changes on
+   the keyframe takes it back a frame. Only the 16K pages written to since
+   the last frame need looking at, which memory_ram_written[] tells us.
+
+   Everything other than RAM is kept per frame as an uncompressed .szx
+   snapshot with no RAM pages in it, which comes to a few hundred bytes.
+
+   Going back abandons everything which was going to happen next, so the
+   event queue is started again as a machine reset would start it. Tape
+   edges belong to the abandoned timeline too, so a playing tape is
+   stopped. */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "fuse.h"
+#include "machine.h"
+#include "memory.h"
+#include "rewind.h"
+#include "rzx.h"
+#include "snapshot.h"
+#include "spectrum.h"
+#include "tape.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+
+int rewind_active = 0;
+
+/* At most this many frames are kept: 30 seconds' worth */
+#define REWIND_FRAMES ( 30 * 50 )
+
+/* And at most this many bytes, counting the keyframe and scratch space
+   as well as the frames */
+static const size_t REWIND_BUDGET = 8 * 1024 * 1024;
+
+/* Unchanged runs of fewer bytes than this are folded into the changed runs
+   either side, as a new run would cost more */
+static const size_t MIN_GAP = 4;
+
+typedef struct rewind_frame_t {
+
+  /* The rest of the machine's state, followed by the changes to RAM in the
+     frame before this one */
+  libspectrum_byte *data;
+  size_t state_length;
+  size_t length;
+
+} rewind_frame_t;
+
+/* The frames recorded, oldest first, as a ring */
+static rewind_frame_t frames[ REWIND_FRAMES ];
+static size_t first, count;
+
+/* How many bytes are in 'frames', and in the keyframe and scratch */
+static size_t bytes, fixed_bytes;
+
+/* RAM as it was at the newest frame, and the number of 16K pages in it.
+   It's never used as the base of another capture, so its pages are its
+   own to change */
+static memory_ram_capture_t *keyframe;
+static size_t ram_pages;
+
+/* Where a frame's RAM changes are put together. The most a page's changes
+   can take is the page itself, its header and one run's header, as runs
+   after the first are only started after an unchanged gap at least as
+   long as a run's header */
+static libspectrum_byte *scratch;
+#define DELTA_PAGE_MAX ( 0x4000 + 3 + 4 )
+
+/* The epoch started at the last frame recorded */
+static libspectrum_dword since;
+
+static rewind_frame_t*
+newest( void )
+{
+  return &frames[ ( first + count - 1 ) % REWIND_FRAMES ];
+}
+
+static void
+drop_oldest( void )
+{
+  bytes -= frames[ first ].length;
+  libspectrum_free( frames[ first ].data );
+  first = ( first + 1 ) % REWIND_FRAMES;
+  count--;
+}
+
+static void
+drop_newest( void )
+{
+  rewind_frame_t *frame = newest();
+
+  bytes -= frame->length;
+  libspectrum_free( frame->data );
+  count--;
+}
+
+int
+rewind_start( void )
+{
+  rewind_stop();
+
+  ram_pages = memory_ram_pages();
+
+  fixed_bytes = sizeof( *keyframe ) +
+                ram_pages * ( sizeof( memory_ram_copy_t ) + DELTA_PAGE_MAX );
+  if( fixed_bytes >= REWIND_BUDGET ) {
+    ui_error( UI_ERROR_ERROR, "rewind: %lu RAM pages won't fit in %lu bytes",
+              (unsigned long)ram_pages, (unsigned long)REWIND_BUDGET );
+    return 1;
+  }
+
+  keyframe = memory_ram_capture( NULL, ram_pages );
+  scratch = libspectrum_malloc( ram_pages * DELTA_PAGE_MAX );
+
+  first = count = bytes = 0;
+  since = memory_ram_epoch_next();
+
+  rewind_active = 1;
+
+  return 0;
+}
+
+void
+rewind_stop( void )
+{
+  if( !rewind_active ) return;
+
+  while( count ) drop_oldest();
+
+  memory_ram_capture_free( keyframe ); keyframe = NULL;
+  libspectrum_free( scratch ); scratch = NULL;
+
+  rewind_active = 0;
+}
+
+/* Everything but RAM, as an .szx file */
+static int
+state_write( libspectrum_byte **buffer, size_t *length )
+{
+  libspectrum_snap *snap = libspectrum_snap_alloc();
+  int error, flags = 0;
+
+  /* RAM is kept separately, so hand the pages straight back rather than
+     copying them only to have them written out */
+  error = snapshot_copy_to_borrowed( snap );
+  memory_snapshot_unborrow( snap );
+  if( error ) { libspectrum_snap_free( snap ); return error; }
+
+  *buffer = NULL; *length = 0;
+  error = libspectrum_snap_write( buffer, length, &flags, snap,
+                                  LIBSPECTRUM_ID_SNAPSHOT_SZX, fuse_creator,
+                                  LIBSPECTRUM_FLAG_SNAPSHOT_NO_COMPRESSION );
+
+  libspectrum_snap_free( snap );
+
+  return error;
+}
+
+/* Append the changes to RAM page 'page' since the keyframe to 'out', and
+   bring the keyframe up to date. Each page changed is written as the page
+   number and a count of runs, followed by the runs, each of which is an
+   offset and length and then that many bytes XORed with their old values;
+   numbers are 16 bits, little endian */
+static libspectrum_byte*
+delta_page( libspectrum_byte *out, size_t page )
+{
+  const libspectrum_byte *ram = RAM[ page ];
+  libspectrum_byte *key = keyframe->pages[ page ]->data;
+  libspectrum_byte *ptr = out + 3;
+  size_t i = 0, j, start, gap, runs = 0;
+
+  while( 1 ) {
+
+    /* Skip what hasn't changed, eight bytes at a time while we can */
+    while( i + 8 <= 0x4000 && !memcmp( ram + i, key + i, 8 ) ) i += 8;
+    while( i < 0x4000 && ram[i] == key[i] ) i++;
+    if( i == 0x4000 ) break;
+
+    /* Take in what has, along with any gaps too short to split on */
+    start = i;
+    while( i < 0x4000 ) {
+      if( ram[i] != key[i] ) { i++; continue; }
+
+      for( gap = 0;
+           i + gap < 0x4000 && gap < MIN_GAP && ram[ i + gap ] == key[ i + gap ];
+           gap++ )
+        ;
+      if( gap == MIN_GAP || i + gap == 0x4000 ) break;
+
+      i += gap;
+    }
+
+    *ptr++ = start & 0xff; *ptr++ = start >> 8;
+    *ptr++ = ( i - start ) & 0xff; *ptr++ = ( i - start ) >> 8;
+    for( j = start; j < i; j++ ) {
+      *ptr++ = ram[j] ^ key[j];
+      key[j] = ram[j];
+    }
+
+    runs++;
+  }
+
+  if( !runs ) return out;
+
+  out[0] = page; out[1] = runs & 0xff; out[2] = runs >> 8;
+
+  return ptr;
+}
+
+/* Undo a frame's changes to RAM on the keyframe */
+static void
+delta_undo( const libspectrum_byte *delta, size_t length )
+{
+  const libspectrum_byte *end = delta + length;
+  libspectrum_byte *key;
+  size_t runs, offset, run_length, i;
+
+  while( delta < end ) {
+    key = keyframe->pages[ delta[0] ]->data;
+    runs = delta[1] | delta[2] << 8;
+    delta += 3;
+
+    while( runs-- ) {
+      offset = delta[0] | delta[1] << 8;
+      run_length = delta[2] | delta[3] << 8;
+      delta += 4;
+
+      for( i = 0; i < run_length; i++ ) key[ offset + i ] ^= delta[i];
+      delta += run_length;
+    }
+  }
+}
+
+void
+rewind_frame( void )
+{
+  rewind_frame_t *frame;
+  libspectrum_byte *buffer, *end;
+  size_t length, delta_length, page;
+
+  if( state_write( &buffer, &length ) ) {
+    ui_error( UI_ERROR_ERROR, "rewind: couldn't record frame; stopping" );
+    rewind_stop();
+    return;
+  }
+
+  end = scratch;
+  for( page = 0; page < ram_pages; page++ )
+    if( memory_ram_written[ page ] >= since ) end = delta_page( end, page );
+  since = memory_ram_epoch_next();
+
+  delta_length = end - scratch;
+  buffer = libspectrum_realloc( buffer, length + delta_length );
+  memcpy( buffer + length, scratch, delta_length );
+
+  while( count &&
+         ( count == REWIND_FRAMES ||
+           fixed_bytes + bytes + length + delta_length > REWIND_BUDGET ) )
+    drop_oldest();
+
+  count++;
+  frame = newest();
+  frame->data = buffer;
+  frame->state_length = length;
+  frame->length = length + delta_length;
+  bytes += frame->length;
+}
+
+int
+rewind_step_back( size_t nframes )
+{
+  rewind_frame_t *frame;
+  libspectrum_snap *snap;
+  int error;
+
+  if( !rewind_active || !count ) return 1;
+
+  /* .rzx files are a record of one timeline, and can't jump back in it */
+  if( rzx_playback || rzx_recording ) return 1;
+
+  /* The oldest frame's changes lead back to a state we no longer have */
+  for( ; nframes && count > 1; nframes-- ) {
+    frame = newest();
+    delta_undo( frame->data + frame->state_length,
+                frame->length - frame->state_length );
+    drop_newest();
+  }
+
+  frame = newest();
+
+  if( tape_is_playing() ) tape_stop();
+
+  /* Start the event queue again as machine_select() does. The frame's
+     state was recorded at its end event, which the restored tstates will
+     be past, so that comes straight round again; anything else which
+     should happen is scheduled again from the state restored */
+  event_reset();
+  event_add( 0, timer_event );
+  event_add( machine_current->timings.tstates_per_frame, spectrum_frame_event );
+
+  snap = libspectrum_snap_alloc();
+  error = libspectrum_snap_read( snap, frame->data, frame->state_length,
+                                 LIBSPECTRUM_ID_SNAPSHOT_SZX, NULL );
+  if( !error ) error = snapshot_copy_from_without_reset( snap );
+  libspectrum_snap_free( snap );
+  if( error ) return error;
+
+  memory_ram_restore( keyframe );
+  since = keyframe->epoch;
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+------------------------------------------------------------
+	SFIFO 1.3
+------------------------------------------------------------
+ * Simple portable lock-free FIFO
+ * (c) 2000-2002, David Olofson
+ * Released under the GNU LESSER GENERAL PUBLIC LICENSE Version 2.1
+ *
+ * Fuse: rewritten around C11 atomics; see sfifo.h.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sfifo.h"
+
+/*
+ * Alloc buffer, init FIFO etc...
+ */
+int sfifo_init(sfifo_t *f, int size)
+{
+	memset(f, 0, sizeof(sfifo_t));
+
+	if(size > SFIFO_MAX_BUFFER_SIZE)
+		return -EINVAL;
+
+	/*
+	 * Set sufficient power-of-2 size.
+	 */
+	f->size = 1;
+	do
+		f->size <<= 1;
+	while(f->size < (unsigned int)size);
+
+	f->buffer = (char *)malloc(f->size);
+	if(!f->buffer)
+		return -ENOMEM;
+
+	atomic_init(&f->readpos, 0);
+	atomic_init(&f->writepos, 0);
+	return 0;
+}
+
+/*
+ * Dealloc buffer etc...
+ */
+void sfifo_close(sfifo_t *f)
+{
+	if(f->buffer)
+		free(f->buffer);
+	f->buffer = NULL;
+}
+
+/*
+ * Empty FIFO buffer. Only safe while neither side is using it.
+ */
+void sfifo_flush(sfifo_t *f)
+{
+	atomic_store(&f->readpos, 0);
+	atomic_store(&f->writepos, 0);
+}
+
+/*
+ * Write bytes to a FIFO
+ * Return number of bytes written, or an error code
+ */
+int sfifo_write(sfifo_t *f, const void *_buf, int len)
+{
+	const char *buf = (const char *)_buf;
+	unsigned int readpos, writepos, offset, total;
+
+	if(!f->buffer)
+		return -ENODEV;	/* No buffer! */
+
+	/* The reader's position needs acquiring, so that we don't
+	   overwrite what it hasn't finished reading yet */
+	writepos = atomic_load_explicit(&f->writepos, memory_order_relaxed);
+	readpos = atomic_load_explicit(&f->readpos, memory_order_acquire);
+
+	total = f->size - (writepos - readpos);
+	if((unsigned int)len > total)
+		len = total;
+	else
+		total = len;
+
+	offset = writepos & SFIFO_SIZEMASK(f);
+	if(offset + total > f->size)
+	{
+		memcpy(f->buffer + offset, buf, f->size - offset);
+		buf += f->size - offset;
+		total -= f->size - offset;
+		offset = 0;
+	}
+	memcpy(f->buffer + offset, buf, total);
+
+	/* And ours needs releasing, so that the reader sees the data */
+	atomic_store_explicit(&f->writepos, writepos + len,
+			memory_order_release);
+
+	return len;
+}
+
+/*
+ * Read bytes from a FIFO
+ * Return number of bytes read, or an error code
+ */
+int sfifo_read(sfifo_t *f, void *_buf, int len)
+{
+	char *buf = (char *)_buf;
+	unsigned int readpos, writepos, offset, total;
+
+	if(!f->buffer)
+		return -ENODEV;	/* No buffer! */
+
+	readpos = atomic_load_explicit(&f->readpos, memory_order_relaxed);
+	writepos = atomic_load_explicit(&f->writepos, memory_order_acquire);
+
+	total = writepos - readpos;
+	if((unsigned int)len > total)
+		len = total;
+	else
+		total = len;
+
+	offset = readpos & SFIFO_SIZEMASK(f);
+	if(offset + total > f->size)
+	{
+		memcpy(buf, f->buffer + offset, f->size - offset);
+		buf += f->size - offset;
+		total -= f->size - offset;
+		offset = 0;
+	}
+	memcpy(buf, f->buffer + offset, total);
+
+	atomic_store_explicit(&f->readpos, readpos + len,
+			memory_order_release);
+
+	return len;
+}
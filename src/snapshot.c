@@ -27,6 +27,7 @@
 
 #include <libspectrum.h>
 
+#include "display.h"
 #include "fuse.h"
 #include "machine.h"
 #include "memory.h"
@@ -80,8 +81,8 @@ snapshot_read_buffer( const unsigned char *buffer, size_t length,
   return 0;
 }
 
-int
-snapshot_copy_from( libspectrum_snap *snap )
+static int
+snapshot_copy_from_ex( libspectrum_snap *snap, int reset )
 {
   int error;
   libspectrum_machine machine;
@@ -99,7 +100,7 @@ snapshot_copy_from( libspectrum_snap *snap )
 		"Loading a %s snapshot, but that's not available",
 		libspectrum_machine_name( machine ) );
     }
-  } else {
+  } else if( reset ) {
     machine_reset( 0 );
   }
 
@@ -109,9 +110,24 @@ snapshot_copy_from( libspectrum_snap *snap )
      initialising from the snapshot */
   machine_current->memory_map();
 
+  /* machine_reset() would have done this */
+  if( !reset ) display_refresh_all();
+
   return 0;
 }
 
+int
+snapshot_copy_from( libspectrum_snap *snap )
+{
+  return snapshot_copy_from_ex( snap, 1 );
+}
+
+int
+snapshot_copy_from_without_reset( libspectrum_snap *snap )
+{
+  return snapshot_copy_from_ex( snap, 0 );
+}
+
 int snapshot_write( const char *filename )
 {
   libspectrum_id_t type;
@@ -133,14 +149,19 @@ int snapshot_write( const char *filename )
 
   snap = libspectrum_snap_alloc();
 
-  error = snapshot_copy_to( snap );
-  if( error ) { libspectrum_snap_free( snap ); return error; }
+  /* The snapshot is only written out, so it can use RAM directly */
+  error = snapshot_copy_to_borrowed( snap );
+  if( error ) {
+    memory_snapshot_unborrow( snap ); libspectrum_snap_free( snap );
+    return error;
+  }
 
   flags = 0;
   length = 0;
   buffer = NULL;
   error = libspectrum_snap_write( &buffer, &length, &flags, snap, type,
 				  fuse_creator, 0 );
+  memory_snapshot_unborrow( snap );
   if( error ) { libspectrum_snap_free( snap ); return error; }
 
   if( flags & LIBSPECTRUM_FLAG_SNAPSHOT_MAJOR_INFO_LOSS ) {
@@ -167,13 +188,26 @@ int snapshot_write( const char *filename )
 
 }
 
-int
-snapshot_copy_to( libspectrum_snap *snap )
+static int
+snapshot_copy_to_ex( libspectrum_snap *snap, int borrow_ram )
 {
   libspectrum_snap_set_machine( snap, machine_current->machine );
   libspectrum_snap_set_late_timings( snap, settings_current.late_timings );
 
   module_snapshot_to( snap );
+  memory_to_snapshot_ex( snap, borrow_ram );
 
   return 0;
 }
+
+int
+snapshot_copy_to( libspectrum_snap *snap )
+{
+  return snapshot_copy_to_ex( snap, 0 );
+}
+
+int
+snapshot_copy_to_borrowed( libspectrum_snap *snap )
+{
+  return snapshot_copy_to_ex( snap, 1 );
+}
@@ -30,9 +30,13 @@
 
 #include <config.h>
 
+#include <stdio.h>
+#include <string.h>
+
 #include "fuse.h"
 #include "machine.h"
 #include "options.h"
+#include "perf.h"
 #include "settings.h"
 #include "sound.h"
 #include "tape.h"
@@ -56,11 +60,8 @@ int sound_stereo_ay = SOUND_STEREO_AY_NONE; /* local copy of settings_current.st
 #define AMPL_TAPE		( 2 * 256 )
 #define AMPL_AY_TONE		( 24 * 256 )	/* three of these */
 
-/* max. number of sub-frame AY port writes allowed;
- * given the number of port writes theoretically possible in a
- * 50th I think this should be plenty.
- */
-#define AY_CHANGE_MAX		8000
+/* entries the AY change log starts with; it grows as needed */
+#define AY_CHANGE_INITIAL	256
 
 int sound_framesiz;
 
@@ -82,8 +83,18 @@ struct ay_change_tag
   unsigned char reg, val;
 };
 
-static struct ay_change_tag ay_change[ AY_CHANGE_MAX ];
-static int ay_change_count;
+/* AY port writes so far this frame, in order */
+static struct ay_change_tag *ay_change = NULL;
+static int ay_change_count, ay_change_size;
+
+/* What each register will hold once the log has been played, or -1 if
+   the next write to it must be logged whatever its value */
+static int ay_change_last[16];
+
+/* Set if the envelope shape has been written to since sound was last on,
+   so sound_init() must restart the envelope. Nothing has been played at
+   all to start with */
+static int ay_envelope_written_off = 1;
 
 Blip_Buffer *left_buf = NULL;
 Blip_Buffer *right_buf = NULL;
@@ -148,7 +159,7 @@ sound_init_blip( Blip_Buffer **buf, Blip_Synth **synth )
 }
 
 static void
-sound_ay_init( void )
+ay_levels_init( void )
 {
   /* AY output doesn't match the claimed levels; these levels are based
    * on the measurements posted to comp.sys.sinclair in Dec 2001 by
@@ -166,6 +177,14 @@ sound_ay_init( void )
   /* scale the values down to fit */
   for( f = 0; f < 16; f++ )
     ay_tone_levels[f] = ( levels[f] * AMPL_AY_TONE + 0x8000 ) / 0xffff;
+}
+
+static void
+sound_ay_init( void )
+{
+  int f;
+
+  ay_levels_init();
 
   ay_noise_tick = ay_noise_period = 0;
   ay_env_internal_tick = ay_env_tick = ay_env_period = 0;
@@ -174,6 +193,8 @@ sound_ay_init( void )
     ay_tone_tick[f] = ay_tone_high[f] = 0, ay_tone_period[f] = 1;
 
   ay_change_count = 0;
+  for( f = 0; f < 16; f++ )
+    ay_change_last[f] = -1;
 }
 
 void
@@ -185,6 +206,7 @@ sound_init( const char *device )
   Blip_Synth **ay_mid_synth;
   Blip_Synth **ay_mid_synth_r;
   Blip_Synth **ay_right_synth;
+  int r;
 
   /* Allow sound as long as emulation speed is greater than 2%
      (less than that and a single Speccy frame generates more
@@ -276,6 +298,18 @@ sound_init( const char *device )
 
   sound_enabled = sound_enabled_ever = 1;
 
+  /* AY writes aren't logged while sound is off, so pick up from what the
+     chip holds now. Only registers which have changed need logging, and
+     the envelope shape only if it was written to, as that restarts the
+     envelope */
+  ay_change_count = 0;
+  for( r = 0; r < 16; r++ ) {
+    ay_change_last[r] = sound_ay_registers[r];
+    if( r != 13 || ay_envelope_written_off )
+      sound_ay_write( r, machine_current->ay.registers[r], 0 );
+  }
+  ay_envelope_written_off = 0;
+
   sound_channels = ( sound_stereo_ay != SOUND_STEREO_AY_NONE ? 2 : 1 );
 
   /* Adjust relative processor speed to deal with adjusting sound generation
@@ -385,12 +419,260 @@ ay_do_tone( int level, unsigned int tone_count, int *var, int chan )
    master clock by 2 to drive the AY */
 #define AY_CLOCK_RATIO 2
 
+/* Tstates in each step sound_ay_overlay() takes through the frame */
+#define AY_STEP ( AY_CLOCK_DIVISOR * AY_CLOCK_RATIO )
+
+static int rng = 1;
+static int noise_toggle = 0;
+static int env_first = 1, env_rev = 0, env_counter = 15;
+
+/* One tick of the envelope generator */
+static void
+ay_env_clock( int envshape )
+{
+  ay_env_tick++;
+  while( ay_env_tick >= ay_env_period ) {
+    ay_env_tick -= ay_env_period;
+
+    /* do a 1/16th-of-period incr/decr if needed */
+    if( env_first ||
+        ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
+      if( env_rev )
+        env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+      else
+        env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+      if( env_counter < 0 )
+        env_counter = 0;
+      if( env_counter > 15 )
+        env_counter = 15;
+    }
+
+    ay_env_internal_tick++;
+    while( ay_env_internal_tick >= 16 ) {
+      ay_env_internal_tick -= 16;
+
+      /* end of cycle */
+      if( !( envshape & AY_ENV_CONT ) )
+        env_counter = 0;
+      else {
+        if( envshape & AY_ENV_HOLD ) {
+          if( env_first && ( envshape & AY_ENV_ALT ) )
+            env_counter = ( env_counter ? 0 : 15 );
+        } else {
+          /* non-hold */
+          if( envshape & AY_ENV_ALT )
+            env_rev = !env_rev;
+          else
+            env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
+        }
+      }
+
+      env_first = 0;
+    }
+
+    /* don't keep trying if period is zero */
+    if( !ay_env_period )
+      break;
+  }
+}
+
+/* One tick of the noise generator */
+static void
+ay_noise_clock( void )
+{
+  if( ( rng & 1 ) ^ ( ( rng & 2 ) ? 1 : 0 ) )
+    noise_toggle = !noise_toggle;
+
+  /* rng is 17-bit shift reg, bit 0 is output.
+   * input is bit 0 xor bit 3.
+   */
+  if( rng & 1 ) {
+    rng ^= 0x24000;
+  }
+  rng >>= 1;
+}
+
+/* Steps until the envelope next moves, counting the step it moves in */
+static unsigned int
+ay_env_steps( void )
+{
+  if( !ay_env_period || ay_env_tick + 1 >= ay_env_period ) return 1;
+  return ay_env_period - ay_env_tick;
+}
+
+/* And the same for the noise generator */
+static unsigned int
+ay_noise_steps( void )
+{
+  if( !ay_noise_period || ay_noise_tick + 1 >= ay_noise_period ) return 1;
+  return ay_noise_period - ay_noise_tick;
+}
+
+/* And for a tone generator's output flipping */
+static unsigned int
+ay_tone_steps( int chan )
+{
+  unsigned int period = ay_tone_period[ chan ], tick = ay_tone_tick[ chan ];
+
+  if( period <= 2 || tick + 2 >= period ) return 1;
+  return ( period - tick + 1 ) / 2;
+}
+
+/* Run the envelope generator on by 'steps' steps, as that many calls to
+   ay_env_clock() would */
+static void
+ay_env_advance( unsigned int steps, int envshape )
+{
+  unsigned int quiet;
+
+  /* Once a one-shot envelope has finished, nothing but the ticks move */
+  if( !env_first &&
+      ( ( envshape & AY_ENV_CONT ) ? ( envshape & AY_ENV_HOLD ) :
+                                     !env_counter ) &&
+      !ay_env_period ) {
+    ay_env_tick += steps;
+    ay_env_internal_tick = ( ay_env_internal_tick + steps ) % 16;
+    return;
+  }
+
+  while( steps ) {
+    quiet = ay_env_steps() - 1;
+    if( quiet ) {
+      if( quiet > steps ) quiet = steps;
+      ay_env_tick += quiet;
+      steps -= quiet;
+    } else {
+      ay_env_clock( envshape );
+      steps--;
+    }
+  }
+}
+
+static void
+ay_noise_advance( unsigned int steps )
+{
+  unsigned int quiet;
+
+  while( steps ) {
+    if( !ay_noise_period ) {
+      /* Clocks every step, and the tick just counts up */
+      ay_noise_tick++;
+      ay_noise_clock();
+      steps--;
+      continue;
+    }
+
+    quiet = ay_noise_period - ay_noise_tick;
+    if( quiet > steps ) {
+      ay_noise_tick += steps;
+      break;
+    }
+
+    ay_noise_tick = 0;
+    ay_noise_clock();
+    steps -= quiet;
+  }
+}
+
+static void
+ay_tone_advance( int chan, unsigned int steps )
+{
+  unsigned int period = ay_tone_period[ chan ], next;
+
+  /* Flips every step */
+  if( period <= 2 ) {
+    ay_tone_tick[ chan ] += steps * ( 2 - period );
+    ay_tone_high[ chan ] ^= steps & 1;
+    return;
+  }
+
+  while( steps ) {
+    next = ay_tone_steps( chan );
+    if( next > steps ) {
+      ay_tone_tick[ chan ] += 2 * steps;
+      break;
+    }
+
+    ay_tone_tick[ chan ] += 2 * next - period;
+    ay_tone_high[ chan ] = !ay_tone_high[ chan ];
+    steps -= next;
+  }
+}
+
+/* How many steps from here can be skipped over without any channel's
+   output changing: those before the next register change, flip of an
+   audible tone, or step after the envelope or noise generator moves
+   while something can hear it. 'env_moved' and 'noise_moved' say whether
+   they just did */
+static unsigned int
+ay_quiet_steps( libspectrum_dword f, const struct ay_change_tag *next_change,
+                int changes_left, int env_moved, int noise_moved )
+{
+  libspectrum_dword frame_length = machine_current->timings.tstates_per_frame;
+  unsigned int quiet, limit, chan;
+  int mixer = sound_ay_registers[7], amplitude, env_heard = 0,
+    noise_heard = 0;
+
+  if( f >= frame_length ) return 0;
+  quiet = ( frame_length - f + AY_STEP - 1 ) / AY_STEP;
+
+  if( changes_left ) {
+    limit = next_change->tstates <= f ?
+            0 : ( next_change->tstates - f + AY_STEP - 1 ) / AY_STEP;
+    if( limit < quiet ) quiet = limit;
+  }
+
+  for( chan = 0; chan < 3; chan++ ) {
+    amplitude = sound_ay_registers[ 8 + chan ];
+
+    /* Level 0 is silent whatever the tone and noise are doing */
+    if( !( amplitude & 0x1f ) ) continue;
+
+    if( amplitude & 16 ) env_heard = 1;
+    if( !( mixer & ( 8 << chan ) ) ) noise_heard = 1;
+
+    /* A period of 1 isn't played */
+    if( !( mixer & ( 1 << chan ) ) && ay_tone_period[ chan ] != 1 ) {
+      limit = ay_tone_steps( chan ) - 1;
+      if( limit < quiet ) quiet = limit;
+    }
+  }
+
+  if( ( env_heard && env_moved ) || ( noise_heard && noise_moved ) )
+    return 0;
+
+  if( env_heard ) {
+    limit = ay_env_steps();
+    if( limit < quiet ) quiet = limit;
+  }
+
+  if( noise_heard ) {
+    limit = ay_noise_steps();
+    if( limit < quiet ) quiet = limit;
+  }
+
+  return quiet;
+}
+
+/* Run everything on by 'steps' steps in which the output doesn't change */
+static void
+ay_advance( unsigned int steps )
+{
+  int mixer = sound_ay_registers[7], chan;
+
+  ay_env_advance( steps, sound_ay_registers[13] );
+  ay_noise_advance( steps );
+
+  for( chan = 0; chan < 3; chan++ )
+    if( !( mixer & ( 1 << chan ) ) ) ay_tone_advance( chan, steps );
+}
+
+/* Steps through the frame AY_STEP tstates at a time. Only steps in which
+   an output can change are worked through in full; between those, the
+   generators are moved on in bulk by ay_advance() */
 static void
 sound_ay_overlay( void )
 {
-  static int rng = 1;
-  static int noise_toggle = 0;
-  static int env_first = 1, env_rev = 0, env_counter = 15;
   int tone_level[3];
   int mixer, envshape;
   int g, level;
@@ -400,7 +682,8 @@ sound_ay_overlay( void )
   int reg, r;
   int chan1, chan2, chan3;
   int last_chan1 = 0, last_chan2 = 0, last_chan3 = 0;
-  unsigned int tone_count, noise_count;
+  int env_was, noise_was;
+  unsigned int tone_count, noise_count, quiet;
 
   /* If no AY chip, don't produce any AY sound (!) */
   if( !( periph_is_active( PERIPH_TYPE_FULLER) ||
@@ -408,8 +691,7 @@ sound_ay_overlay( void )
          machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY ) )
     return;
 
-  for( f = 0; f < machine_current->timings.tstates_per_frame;
-       f+= AY_CLOCK_DIVISOR * AY_CLOCK_RATIO ) {
+  for( f = 0; f < machine_current->timings.tstates_per_frame; ) {
     /* update ay registers. */
     while( changes_left && f >= change_ptr->tstates ) {
       sound_ay_registers[ reg = change_ptr->reg ] = change_ptr->val;
@@ -462,55 +744,13 @@ sound_ay_overlay( void )
         tone_level[g] = level;
 
     /* envelope output counter gets incr'd every 16 AY cycles. */
+    env_was = env_counter;
     ay_env_cycles += AY_CLOCK_DIVISOR;
     noise_count = 0;
     while( ay_env_cycles >= 16 ) {
       ay_env_cycles -= 16;
       noise_count++;
-      ay_env_tick++;
-      while( ay_env_tick >= ay_env_period ) {
-        ay_env_tick -= ay_env_period;
-
-        /* do a 1/16th-of-period incr/decr if needed */
-        if( env_first ||
-            ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
-          if( env_rev )
-            env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          else
-            env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          if( env_counter < 0 )
-            env_counter = 0;
-          if( env_counter > 15 )
-            env_counter = 15;
-        }
-
-        ay_env_internal_tick++;
-        while( ay_env_internal_tick >= 16 ) {
-          ay_env_internal_tick -= 16;
-
-          /* end of cycle */
-          if( !( envshape & AY_ENV_CONT ) )
-            env_counter = 0;
-          else {
-            if( envshape & AY_ENV_HOLD ) {
-              if( env_first && ( envshape & AY_ENV_ALT ) )
-                env_counter = ( env_counter ? 0 : 15 );
-            } else {
-              /* non-hold */
-              if( envshape & AY_ENV_ALT )
-                env_rev = !env_rev;
-              else
-                env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
-            }
-          }
-
-          env_first = 0;
-        }
-
-        /* don't keep trying if period is zero */
-        if( !ay_env_period )
-          break;
-      }
+      ay_env_clock( envshape );
     }
 
     /* generate tone+noise... or neither.
@@ -565,25 +805,27 @@ sound_ay_overlay( void )
     }
 
     /* update noise RNG/filter */
+    noise_was = noise_toggle;
     ay_noise_tick += noise_count;
     while( ay_noise_tick >= ay_noise_period ) {
       ay_noise_tick -= ay_noise_period;
 
-      if( ( rng & 1 ) ^ ( ( rng & 2 ) ? 1 : 0 ) )
-        noise_toggle = !noise_toggle;
-
-      /* rng is 17-bit shift reg, bit 0 is output.
-       * input is bit 0 xor bit 3.
-       */
-      if( rng & 1 ) {
-        rng ^= 0x24000;
-      }
-      rng >>= 1;
+      ay_noise_clock();
 
       /* don't keep trying if period is zero */
       if( !ay_noise_period )
         break;
     }
+
+    f += AY_STEP;
+
+    quiet = ay_quiet_steps( f, change_ptr, changes_left,
+                            env_counter != env_was,
+                            noise_toggle != noise_was );
+    if( quiet ) {
+      ay_advance( quiet );
+      f += quiet * AY_STEP;
+    }
   }
 }
 
@@ -593,12 +835,45 @@ sound_ay_overlay( void )
 void
 sound_ay_write( int reg, int val, libspectrum_dword now )
 {
-  if( ay_change_count < AY_CHANGE_MAX ) {
-    ay_change[ ay_change_count ].tstates = now;
-    ay_change[ ay_change_count ].reg = ( reg & 15 );
-    ay_change[ ay_change_count ].val = val;
-    ay_change_count++;
+  struct ay_change_tag *change;
+
+  reg &= 15;
+  val &= 0xff;
+
+  /* nothing plays the log while sound is off; sound_init() catches up */
+  if( !sound_enabled ) {
+    if( reg == 13 ) ay_envelope_written_off = 1;
+    return;
+  }
+
+  /* a write which leaves the register as it was does nothing, except to
+   * the envelope shape, which restarts the envelope.
+   */
+  if( val == ay_change_last[ reg ] && reg != 13 )
+    return;
+  ay_change_last[ reg ] = val;
+
+  /* a second write to the same register at the same time replaces the
+   * first.
+   */
+  if( ay_change_count ) {
+    change = &ay_change[ ay_change_count - 1 ];
+    if( change->tstates == now && change->reg == reg ) {
+      change->val = val;
+      return;
+    }
+  }
+
+  if( ay_change_count == ay_change_size ) {
+    ay_change_size = ay_change_size ? ay_change_size * 2 : AY_CHANGE_INITIAL;
+    ay_change = libspectrum_realloc( ay_change,
+                                     ay_change_size * sizeof( *ay_change ) );
   }
+
+  change = &ay_change[ ay_change_count++ ];
+  change->tstates = now;
+  change->reg = reg;
+  change->val = val;
 }
 
 /* no need to call this initially, but should be called
@@ -640,12 +915,15 @@ void
 sound_frame( void )
 {
   long count;
+  perf_phase previous_phase;
 
   if( !sound_enabled )
     return;
 
   /* overlay AY sound */
+  previous_phase = perf_enter( PERF_PHASE_AY );
   sound_ay_overlay();
+  perf_leave( previous_phase );
 
   blip_buffer_end_frame( left_buf, machine_current->timings.tstates_per_frame );
 
@@ -654,8 +932,8 @@ sound_frame( void )
 
     /* Read left channel into even samples, right channel into odd samples:
        LRLRLRLRLR... */
-    count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, 1 );
-    blip_buffer_read_samples( right_buf, samples + 1, count, 1 );
+    count = blip_buffer_read_samples_stereo( left_buf, right_buf, samples,
+                                             sound_framesiz );
     count <<= 1;
   } else {
     count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, BLIP_BUFFER_DEF_STEREO );
@@ -664,6 +942,7 @@ sound_frame( void )
   if( settings_current.sound ) 
     sound_lowlevel_frame( samples, count );
 
+  perf_count( PERF_COUNTER_AY_LOG, ay_change_count );
   ay_change_count = 0;
 }
 
@@ -691,3 +970,217 @@ sound_beeper( int on )
   if( sound_stereo_ay != SOUND_STEREO_AY_NONE )
     blip_synth_update( right_beeper_synth, tstates, val );
 }
+
+#define SOUND_TEST_FRAMES 50
+#define SOUND_TEST_SAMPLES 2048
+
+/* Everything sound_ay_overlay() reads or changes, so the test can put it
+   all back afterwards */
+struct sound_test_ay_state {
+  libspectrum_byte registers[16];
+  unsigned int tone_tick[3], tone_high[3], tone_period[3];
+  unsigned int noise_tick, noise_period;
+  unsigned int tone_cycles, env_cycles;
+  unsigned int env_internal_tick, env_tick, env_period;
+  int rng, noise_toggle, env_first, env_rev, env_counter;
+  struct ay_change_tag *change;
+  int change_count, change_size;
+  Blip_Synth *synths[6];
+};
+
+static void
+sound_test_ay_save( struct sound_test_ay_state *state )
+{
+  memcpy( state->registers, sound_ay_registers, sizeof( state->registers ) );
+  memcpy( state->tone_tick, ay_tone_tick, sizeof( state->tone_tick ) );
+  memcpy( state->tone_high, ay_tone_high, sizeof( state->tone_high ) );
+  memcpy( state->tone_period, ay_tone_period, sizeof( state->tone_period ) );
+  state->noise_tick = ay_noise_tick; state->noise_period = ay_noise_period;
+  state->tone_cycles = ay_tone_cycles; state->env_cycles = ay_env_cycles;
+  state->env_internal_tick = ay_env_internal_tick;
+  state->env_tick = ay_env_tick; state->env_period = ay_env_period;
+  state->rng = rng; state->noise_toggle = noise_toggle;
+  state->env_first = env_first; state->env_rev = env_rev;
+  state->env_counter = env_counter;
+  state->change = ay_change;
+  state->change_count = ay_change_count;
+  state->change_size = ay_change_size;
+  state->synths[0] = ay_a_synth; state->synths[1] = ay_b_synth;
+  state->synths[2] = ay_c_synth; state->synths[3] = ay_a_synth_r;
+  state->synths[4] = ay_b_synth_r; state->synths[5] = ay_c_synth_r;
+}
+
+static void
+sound_test_ay_load( const struct sound_test_ay_state *state )
+{
+  memcpy( sound_ay_registers, state->registers, sizeof( state->registers ) );
+  memcpy( ay_tone_tick, state->tone_tick, sizeof( state->tone_tick ) );
+  memcpy( ay_tone_high, state->tone_high, sizeof( state->tone_high ) );
+  memcpy( ay_tone_period, state->tone_period, sizeof( state->tone_period ) );
+  ay_noise_tick = state->noise_tick; ay_noise_period = state->noise_period;
+  ay_tone_cycles = state->tone_cycles; ay_env_cycles = state->env_cycles;
+  ay_env_internal_tick = state->env_internal_tick;
+  ay_env_tick = state->env_tick; ay_env_period = state->env_period;
+  rng = state->rng; noise_toggle = state->noise_toggle;
+  env_first = state->env_first; env_rev = state->env_rev;
+  env_counter = state->env_counter;
+  ay_change = state->change;
+  ay_change_count = state->change_count;
+  ay_change_size = state->change_size;
+  ay_a_synth = state->synths[0]; ay_b_synth = state->synths[1];
+  ay_c_synth = state->synths[2]; ay_a_synth_r = state->synths[3];
+  ay_b_synth_r = state->synths[4]; ay_c_synth_r = state->synths[5];
+}
+
+/* Put the AY's generators as they are after a reset */
+static void
+sound_test_ay_reset( void )
+{
+  int f;
+
+  ay_levels_init();
+
+  memset( sound_ay_registers, 0, sizeof( sound_ay_registers ) );
+  ay_noise_tick = ay_noise_period = 0;
+  ay_env_internal_tick = ay_env_tick = ay_env_period = 0;
+  ay_tone_cycles = ay_env_cycles = 0;
+  for( f = 0; f < 3; f++ )
+    ay_tone_tick[f] = ay_tone_high[f] = 0, ay_tone_period[f] = 1;
+  rng = 1;
+  noise_toggle = 0;
+  env_first = 1; env_rev = 0; env_counter = 15;
+}
+
+static void
+sound_test_ay_log( int reg, int val, libspectrum_dword t )
+{
+  struct ay_change_tag *change = &ay_change[ ay_change_count++ ];
+
+  change->tstates = t;
+  change->reg = reg;
+  change->val = val;
+}
+
+/* Log a frame of writes to random registers, with short enough periods
+   that every generator moves within the frame. With 'every_step' set,
+   also log a write to the I/O register 14 at each step, which sound
+   nothing but stops sound_ay_overlay() skipping any steps */
+static void
+sound_test_ay_writes( unsigned int *seed, libspectrum_dword frame_length,
+                      int every_step )
+{
+  libspectrum_dword t, step = 0;
+  int reg, val;
+
+  ay_change_count = 0;
+
+  for( t = 0; t < frame_length; t += 1 + ( *seed >> 16 ) % 4000 ) {
+    *seed = *seed * 1103515245 + 12345;
+    reg = ( *seed >> 8 ) % 14;
+    val = ( *seed >> 16 ) & 0xff;
+    if( reg == 1 || reg == 3 || reg == 5 || reg == 12 ) val = 0;
+    if( reg == 11 ) val &= 0x1f;
+
+    for( ; every_step && step <= t; step += AY_STEP )
+      sound_test_ay_log( 14, 0, step );
+    sound_test_ay_log( reg, val, t );
+  }
+
+  for( ; every_step && step < frame_length; step += AY_STEP )
+    sound_test_ay_log( 14, 0, step );
+}
+
+/* Render each of the AY's channels to a buffer of its own, for
+   SOUND_TEST_FRAMES frames of the same writes, into 'samples'; returns
+   the number of samples in each frame, or -1 on error */
+static int
+sound_test_ay_render( blip_sample_t *samples, int every_step )
+{
+  Blip_Synth **synths[3] = { &ay_a_synth, &ay_b_synth, &ay_c_synth };
+  Blip_Buffer *buf[3] = { NULL, NULL, NULL };
+  libspectrum_dword frame_length = machine_current->timings.tstates_per_frame;
+  unsigned int seed = 1;
+  long count = -1;
+  int chan, frame;
+
+  for( chan = 0; chan < 3; chan++ ) *synths[ chan ] = NULL;
+
+  for( chan = 0; chan < 3; chan++ ) {
+    buf[ chan ] = new_Blip_Buffer();
+    *synths[ chan ] = new_Blip_Synth();
+    if( !buf[ chan ] || !*synths[ chan ] ) goto end;
+
+    blip_buffer_set_clock_rate( buf[ chan ], 3546900 );
+    if( blip_buffer_set_sample_rate( buf[ chan ], 44100, 1000 ) ) goto end;
+    blip_synth_set_volume( *synths[ chan ], 0.5 );
+    blip_synth_set_output( *synths[ chan ], buf[ chan ] );
+  }
+
+  sound_test_ay_reset();
+
+  for( frame = 0; frame < SOUND_TEST_FRAMES; frame++ ) {
+    sound_test_ay_writes( &seed, frame_length, every_step );
+    sound_ay_overlay();
+
+    for( chan = 0; chan < 3; chan++ ) {
+      blip_buffer_end_frame( buf[ chan ], frame_length );
+      count = blip_buffer_read_samples( buf[ chan ], samples,
+                                        SOUND_TEST_SAMPLES, 0 );
+      samples += SOUND_TEST_SAMPLES;
+    }
+  }
+
+ end:
+  for( chan = 0; chan < 3; chan++ ) {
+    delete_Blip_Synth( synths[ chan ] );
+    delete_Blip_Buffer( &buf[ chan ] );
+  }
+
+  return count;
+}
+
+/* Check that skipping the quiet steps of the AY gives exactly the same
+   output as working through every one. The AY is rendered into buffers
+   and from a log of the test's own, and everything it touches is put
+   back afterwards */
+int
+sound_unittest( void )
+{
+  struct sound_test_ay_state state;
+  libspectrum_dword frame_length = machine_current->timings.tstates_per_frame;
+  size_t length = SOUND_TEST_FRAMES * 3 * SOUND_TEST_SAMPLES;
+  blip_sample_t *samples[2];
+  int count[2], i, r = 0;
+
+  if( !( machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY ) )
+    return 0;
+
+  sound_test_ay_save( &state );
+
+  ay_a_synth_r = ay_b_synth_r = ay_c_synth_r = NULL;
+  ay_change_size = frame_length + frame_length / AY_STEP + 1;
+  ay_change = libspectrum_malloc( ay_change_size * sizeof( *ay_change ) );
+
+  for( i = 0; i < 2; i++ ) {
+    samples[i] = libspectrum_malloc( length * sizeof( blip_sample_t ) );
+    memset( samples[i], 0, length * sizeof( blip_sample_t ) );
+    count[i] = sound_test_ay_render( samples[i], !i );
+  }
+
+  if( count[0] <= 0 || count[0] != count[1] ) {
+    printf( "%s:%d: AY rendering failed\n", __FILE__, __LINE__ );
+    r = 1;
+  } else if( memcmp( samples[0], samples[1],
+                     length * sizeof( blip_sample_t ) ) ) {
+    printf( "%s:%d: AY output differs when skipping quiet steps\n",
+            __FILE__, __LINE__ );
+    r = 1;
+  }
+
+  for( i = 0; i < 2; i++ ) libspectrum_free( samples[i] );
+  libspectrum_free( ay_change );
+
+  sound_test_ay_load( &state );
+
+  return r;
+}
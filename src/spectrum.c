@@ -35,14 +35,17 @@
 #include "loader.h"
 #include "machine.h"
 #include "memory.h"
+#include "perf.h"
 #include "peripherals/printer.h"
 #include "psg.h"
 #include "profile.h"
+#include "rewind.h"
 #include "rzx.h"
 #include "settings.h"
 #include "sound.h"
 #include "spectrum.h"
 #include "tape.h"
+#include "trace.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/uijoystick.h"
@@ -71,6 +74,7 @@ spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
 {
   if( rzx_playback ) event_force_events();
   rzx_frame();
+  if( rewind_active ) rewind_frame();
   psg_frame();
   spectrum_frame();
   z80_interrupt();
@@ -92,6 +96,7 @@ int
 spectrum_frame( void )
 {
   libspectrum_dword frame_length;
+  perf_phase previous_phase;
 
   /* Reduce the t-state count of both the processor and all the events
      scheduled to occur. Done slightly differently if RZX playback is
@@ -104,10 +109,17 @@ spectrum_frame( void )
   if( z80.interrupts_enabled_at >= 0 )
     z80.interrupts_enabled_at -= frame_length;
 
+  previous_phase = perf_enter( PERF_PHASE_SOUND );
   if( sound_enabled ) sound_frame();
+  perf_leave( previous_phase );
 
-  if( display_frame() ) return 1;
+  previous_phase = perf_enter( PERF_PHASE_DISPLAY );
+  if( display_frame() ) { perf_leave( previous_phase ); return 1; }
+  perf_leave( previous_phase );
+
+  if( perf_active ) perf_frame();
   if( profile_active ) profile_frame( frame_length );
+  if( trace_active ) trace_frame();
   printer_frame();
 
   /* Add an interrupt unless they're being generated by .rzx playback */
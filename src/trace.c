@@ -0,0 +1,258 @@
+/* trace.c: Binary execution trace recorder
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Records every instruction run into a ring buffer, which a separate
+   thread drains to disk, so that the emulation only ever pays for filling
+   in a record. The ring has a single producer (the emulation) and a
+   single consumer (the writer), so needs no locking: each side only
+   writes its own index, and the two indices are kept on separate cache
+   lines so that they don't fight over one.
+
+   The writer sleeps while the ring is empty. Waking it takes a lock, so
+   the emulation only does that every TRACE_WAKE_RECORDS records and at
+   the end of each frame, rather than for every record. If the writer
+   falls behind and the ring fills, the emulation sleeps until the writer
+   has made space, rather than lose records. */
+
+#include <config.h>
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libspectrum.h>
+
+#include "event.h"
+#include "memory.h"
+#include "trace.h"
+#include "ui/ui.h"
+#include "z80/z80.h"
+#include "z80/z80_macros.h"
+
+int trace_active = 0;
+
+/* Must be a power of two */
+#define TRACE_RING_RECORDS ( 1 << 16 )
+
+/* How often the emulation wakes the writer; must be a power of two, and
+   less than the ring size */
+#define TRACE_WAKE_RECORDS ( TRACE_RING_RECORDS / 4 )
+
+static trace_record ring[ TRACE_RING_RECORDS ];
+
+/* Records are written at 'head' and read from 'tail'; both only ever
+   increase, and are taken modulo the ring size when used */
+static _Alignas( 64 ) atomic_size_t head;
+static _Alignas( 64 ) atomic_size_t tail;
+
+/* The emulation's last view of 'tail'; only reloaded when the ring looks
+   full */
+static size_t tail_seen;
+
+static atomic_int stopping;
+
+/* The writer waits on 'filled' for records to write, and the emulation
+   on 'emptied' for space to write them in */
+static GMutex lock;
+static GCond filled, emptied;
+
+/* Set by the writer if the trace file couldn't be written to. It can't
+   stop tracing itself, so it throws records away from then on and leaves
+   that to trace_frame() */
+static atomic_int write_failed;
+
+static GThread *writer;
+static FILE *trace_file;
+
+static libspectrum_dword frame;
+
+/* How many records were written, and how often the ring was full */
+static unsigned long records, stalls;
+
+/* Have the writer look at the ring again */
+static void
+trace_wake( void )
+{
+  g_mutex_lock( &lock );
+  g_cond_signal( &filled );
+  g_mutex_unlock( &lock );
+}
+
+static gpointer
+trace_writer( gpointer data GCC_UNUSED )
+{
+  size_t h, t, n;
+
+  while( 1 ) {
+    h = atomic_load_explicit( &head, memory_order_acquire );
+    t = atomic_load_explicit( &tail, memory_order_relaxed );
+
+    if( h == t ) {
+      if( atomic_load( &stopping ) ) break;
+
+      g_mutex_lock( &lock );
+      while( atomic_load_explicit( &head, memory_order_acquire ) == t &&
+             !atomic_load( &stopping ) )
+        g_cond_wait( &filled, &lock );
+      g_mutex_unlock( &lock );
+      continue;
+    }
+
+    /* Write up to the end of the ring; anything after wraps round and is
+       picked up next time */
+    n = h - t;
+    if( n > TRACE_RING_RECORDS - ( t & ( TRACE_RING_RECORDS - 1 ) ) )
+      n = TRACE_RING_RECORDS - ( t & ( TRACE_RING_RECORDS - 1 ) );
+
+    if( !atomic_load_explicit( &write_failed, memory_order_relaxed ) &&
+        fwrite( &ring[ t & ( TRACE_RING_RECORDS - 1 ) ], sizeof( *ring ), n,
+                trace_file ) != n )
+      atomic_store( &write_failed, 1 );
+
+    g_mutex_lock( &lock );
+    atomic_store_explicit( &tail, t + n, memory_order_release );
+    g_cond_signal( &emptied );
+    g_mutex_unlock( &lock );
+  }
+
+  return NULL;
+}
+
+int
+trace_start( const char *filename )
+{
+  trace_header header;
+
+  if( trace_active ) trace_stop();
+
+  trace_file = fopen( filename, "wb" );
+  if( !trace_file ) {
+    ui_error( UI_ERROR_ERROR, "unable to open trace file '%s' for writing",
+              filename );
+    return 1;
+  }
+
+  memcpy( header.magic, TRACE_MAGIC, 4 );
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof( trace_record );
+  header.byte_order = TRACE_BYTE_ORDER;
+  header.reserved = 0;
+  if( fwrite( &header, sizeof( header ), 1, trace_file ) != 1 ) {
+    ui_error( UI_ERROR_ERROR, "error writing trace file '%s'", filename );
+    fclose( trace_file ); trace_file = NULL;
+    return 1;
+  }
+
+  atomic_store( &head, 0 );
+  atomic_store( &tail, 0 );
+  atomic_store( &stopping, 0 );
+  atomic_store( &write_failed, 0 );
+  tail_seen = 0;
+  frame = 0;
+  records = stalls = 0;
+
+  writer = g_thread_new( "trace", trace_writer, NULL );
+
+  trace_active = 1;
+
+  /* Make sure the main loop notices, as for the profiler */
+  event_add( tstates, event_type_null );
+
+  return 0;
+}
+
+void
+trace_stop( void )
+{
+  if( !trace_active ) return;
+
+  trace_active = 0;
+  event_add( tstates, event_type_null );
+
+  atomic_store( &stopping, 1 );
+  trace_wake();
+  g_thread_join( writer ); writer = NULL;
+
+  if( fclose( trace_file ) && !atomic_load( &write_failed ) )
+    ui_error( UI_ERROR_ERROR, "error writing trace file" );
+  trace_file = NULL;
+
+  ui_error( UI_ERROR_INFO, "trace: %lu instructions; ring full %lu times",
+            records, stalls );
+}
+
+void
+trace_instruction( void )
+{
+  size_t h = atomic_load_explicit( &head, memory_order_relaxed );
+  trace_record *record;
+  memory_page *mapping;
+
+  if( h - tail_seen == TRACE_RING_RECORDS ) {
+    tail_seen = atomic_load_explicit( &tail, memory_order_acquire );
+    if( h - tail_seen == TRACE_RING_RECORDS ) {
+      stalls++;
+      g_mutex_lock( &lock );
+      g_cond_signal( &filled );
+      while( h - ( tail_seen = atomic_load_explicit( &tail,
+                                                     memory_order_acquire ) )
+             == TRACE_RING_RECORDS )
+        g_cond_wait( &emptied, &lock );
+      g_mutex_unlock( &lock );
+    }
+  }
+
+  record = &ring[ h & ( TRACE_RING_RECORDS - 1 ) ];
+
+  record->frame = frame;
+  record->tstates = tstates;
+
+  record->pc = PC; record->af = AF; record->bc = BC; record->de = DE;
+  record->hl = HL; record->sp = SP; record->ix = IX; record->iy = IY;
+
+  record->opcode[0] = readbyte_internal( PC );
+  record->opcode[1] = readbyte_internal( PC + 1 );
+  record->opcode[2] = readbyte_internal( PC + 2 );
+  record->opcode[3] = readbyte_internal( PC + 3 );
+
+  mapping = &memory_map_read[ PC >> MEMORY_PAGE_SIZE_LOGARITHM ];
+  record->source = mapping->source;
+  record->page = mapping->page_num;
+
+  record->reserved[0] = record->reserved[1] = 0;
+
+  atomic_store_explicit( &head, h + 1, memory_order_release );
+  records++;
+
+  if( !( ( h + 1 ) & ( TRACE_WAKE_RECORDS - 1 ) ) ) trace_wake();
+}
+
+void
+trace_frame( void )
+{
+  frame++;
+
+  /* Don't leave the end of the frame sitting in the ring */
+  trace_wake();
+
+  if( atomic_load_explicit( &write_failed, memory_order_relaxed ) ) {
+    ui_error( UI_ERROR_ERROR, "error writing trace file; stopping trace" );
+    trace_stop();
+  }
+}
@@ -25,10 +25,13 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "fuse.h"
 #include "machine.h"
+#include "memory.h"
 #include "mempool.h"
 #include "periph.h"
 #include "peripherals/disk/beta.h"
@@ -42,6 +45,8 @@
 #include "peripherals/if2.h"
 #include "peripherals/ula.h"
 #include "settings.h"
+#include "sound.h"
+#include "sound/blipbuffer.h"
 #include "unittests.h"
 
 static int
@@ -271,6 +276,139 @@ mempool_test( void )
   return 0;
 }
 
+#define BLIP_TEST_FRAMES 50
+#define BLIP_TEST_FRAME_LENGTH 69888
+#define BLIP_TEST_SAMPLES 2048
+
+static int
+blip_test_channel( Blip_Buffer **buf, Blip_Synth **synth, double volume,
+                   double treble )
+{
+  *buf = new_Blip_Buffer();
+  *synth = new_Blip_Synth();
+  TEST_ASSERT( *buf && *synth );
+
+  blip_buffer_set_clock_rate( *buf, 3546900 );
+  TEST_ASSERT( !blip_buffer_set_sample_rate( *buf, 44100, 1000 ) );
+  blip_buffer_set_bass_freq( *buf, 16 );
+  blip_synth_set_volume( *synth, volume );
+  blip_synth_set_output( *synth, *buf );
+  blip_synth_set_treble_eq( *synth, treble );
+
+  return 0;
+}
+
+static void
+blip_test_channel_free( Blip_Buffer **buf, Blip_Synth **synth )
+{
+  delete_Blip_Synth( synth );
+  delete_Blip_Buffer( buf );
+}
+
+/* A frame of edges anything from a tstate to a few hundred apart, of any
+   size */
+static void
+blip_test_edges( Blip_Synth *synth, unsigned int *seed )
+{
+  long t;
+
+  for( t = 0; t < BLIP_TEST_FRAME_LENGTH; t += 1 + ( *seed >> 16 ) % 400 ) {
+    *seed = *seed * 1103515245 + 12345;
+    blip_synth_update( synth, t, ( *seed >> 8 ) % 65536 - 32768 );
+  }
+
+  blip_buffer_end_frame( synth->impl.buf, BLIP_TEST_FRAME_LENGTH );
+}
+
+/* Run the same edges through a buffer with the plain C synthesis and
+   another with 'simd', and check the samples read back are identical */
+static int
+blip_simd_frames( blip_simd_t simd, double volume, double treble )
+{
+  Blip_Buffer *buf[2];
+  Blip_Synth *synth[2];
+  blip_sample_t samples[2][ BLIP_TEST_SAMPLES ];
+  unsigned int seed[2] = { 1, 1 };
+  long count[2];
+  int i, frame;
+
+  for( i = 0; i < 2; i++ )
+    if( blip_test_channel( &buf[i], &synth[i], volume, treble ) ) return 1;
+
+  for( frame = 0; frame < BLIP_TEST_FRAMES; frame++ ) {
+    for( i = 0; i < 2; i++ ) {
+      TEST_ASSERT( !blip_simd_select( i ? simd : BLIP_SIMD_NONE ) );
+      blip_test_edges( synth[i], &seed[i] );
+      count[i] = blip_buffer_read_samples( buf[i], samples[i],
+                                           BLIP_TEST_SAMPLES, 0 );
+    }
+
+    TEST_ASSERT( count[0] > 0 && count[0] == count[1] );
+    TEST_ASSERT( !memcmp( samples[0], samples[1],
+                          count[0] * sizeof( blip_sample_t ) ) );
+  }
+
+  for( i = 0; i < 2; i++ ) blip_test_channel_free( &buf[i], &synth[i] );
+
+  return 0;
+}
+
+/* Reading a pair of buffers together must give the same as reading them
+   one at a time; buffers 0 and 1 are read one way and 2 and 3 the other */
+static int
+blip_stereo_frames( void )
+{
+  Blip_Buffer *buf[4];
+  Blip_Synth *synth[4];
+  blip_sample_t samples[2][ BLIP_TEST_SAMPLES * 2 ];
+  unsigned int seed[4] = { 1, 2, 1, 2 };
+  long count[2];
+  int i, frame;
+
+  for( i = 0; i < 4; i++ )
+    if( blip_test_channel( &buf[i], &synth[i], 0.5, -8.0 ) ) return 1;
+
+  for( frame = 0; frame < BLIP_TEST_FRAMES; frame++ ) {
+    for( i = 0; i < 4; i++ ) blip_test_edges( synth[i], &seed[i] );
+
+    count[0] = blip_buffer_read_samples( buf[0], samples[0],
+                                         BLIP_TEST_SAMPLES, 1 );
+    blip_buffer_read_samples( buf[1], samples[0] + 1, count[0], 1 );
+    count[1] = blip_buffer_read_samples_stereo( buf[2], buf[3], samples[1],
+                                                BLIP_TEST_SAMPLES );
+
+    TEST_ASSERT( count[0] > 0 && count[0] == count[1] );
+    TEST_ASSERT( !memcmp( samples[0], samples[1],
+                          count[0] * 2 * sizeof( blip_sample_t ) ) );
+  }
+
+  for( i = 0; i < 4; i++ ) blip_test_channel_free( &buf[i], &synth[i] );
+
+  return 0;
+}
+
+static int
+blipbuffer_test( void )
+{
+  blip_simd_t simd, best = blip_simd_best();
+  int r = 0;
+
+  for( simd = BLIP_SIMD_NONE + 1; simd < BLIP_SIMD_COUNT; simd++ ) {
+    if( blip_simd_select( simd ) ) continue;
+
+    r += blip_simd_frames( simd, 0.5, -8.0 );
+
+    /* Quiet enough that the kernel gets attenuated */
+    r += blip_simd_frames( simd, 0.001, 0.0 );
+  }
+
+  blip_simd_select( best );
+
+  r += blip_stereo_frames();
+
+  return r;
+}
+
 static int
 assert_page( libspectrum_word base, libspectrum_word length, int source, int page )
 {
@@ -524,12 +662,50 @@ paging_test_pentagon512_unlocked( void )
   return r;
 }
 
+/* Check that RAM captures cover the pages beyond the first 128K, and
+   notice when they have been written to */
+static int
+paging_test_pentagon512_capture( void )
+{
+  memory_ram_capture_t *capture, *next;
+  libspectrum_byte original;
+  int copied, shared, restored;
+
+  TEST_ASSERT( memory_ram_pages() == 32 );
+
+  writeport_internal( 0x7ffd, 0xc7 );
+  original = RAM[31][0];
+
+  writebyte_internal( 0xc000, 0xa5 );
+  capture = memory_ram_capture( NULL, memory_ram_pages() );
+  writebyte_internal( 0xc000, 0x5a );
+
+  next = memory_ram_capture( capture, memory_ram_pages() );
+  copied = next->pages[31] != capture->pages[31] &&
+           next->pages[31]->data[0] == 0x5a;
+  shared = next->pages[0] == capture->pages[0];
+  memory_ram_capture_free( next );
+
+  memory_ram_restore( capture );
+  restored = RAM[31][0] == 0xa5;
+  memory_ram_capture_free( capture );
+
+  RAM[31][0] = original;
+
+  TEST_ASSERT( copied );
+  TEST_ASSERT( shared );
+  TEST_ASSERT( restored );
+
+  return 0;
+}
+
 static int
 paging_test_pentagon512( void )
 {
   int r = 0;
 
   r += paging_test_pentagon512_unlocked();
+  r += paging_test_pentagon512_capture();
   r += paging_test_128_locked( 2 );
 
   return r;
@@ -735,6 +911,8 @@ unittests_run( void )
   r += contention_test();
   r += floating_bus_test();
   r += mempool_test();
+  r += blipbuffer_test();
+  r += sound_unittest();
   r += paging_test();
 
   return r;
@@ -34,6 +34,8 @@
 #include <libspectrum.h>
 
 #include "debugger_internals.h"
+#include "perf.h"
+#include "trace.h"
 #include "ui/ui.h"
 #include "utils.h"
 
@@ -56,6 +58,28 @@ debugger_variable_end( void )
 void
 debugger_variable_set( const char *name, libspectrum_dword value )
 {
+  /* $trace starts and stops the trace recorder, so that tracing can be
+     switched on and off from breakpoint commands; it reads back as
+     whether tracing is on, so stays 0 if the trace couldn't be started */
+  if( !strcmp( name, "trace" ) ) {
+    if( value ) {
+      if( !trace_active ) trace_start( TRACE_DEFAULT_FILE );
+    } else {
+      trace_stop();
+    }
+    value = trace_active;
+  }
+
+  /* $perf turns phase timing on, with reports as text (1) or JSON (2) on
+     stderr, or off (0) */
+  if( !strcmp( name, "perf" ) ) {
+    if( value ) {
+      perf_start( value == 2 ? PERF_OUTPUT_JSON : PERF_OUTPUT_TEXT );
+    } else {
+      perf_stop();
+    }
+  }
+
   /* Check if we need to allocate memory for this key */
   if( !g_hash_table_lookup( debugger_variables, name ) )
     name = utils_safe_strdup( name );
@@ -68,7 +92,12 @@ debugger_variable_set( const char *name, libspectrum_dword value )
 libspectrum_dword
 debugger_variable_get( const char *name )
 {
-  gpointer v = g_hash_table_lookup( debugger_variables, name );
+  gpointer v;
+
+  /* Tracing can also stop by itself, if the trace can't be written */
+  if( !strcmp( name, "trace" ) ) return trace_active;
+
+  v = g_hash_table_lookup( debugger_variables, name );
 
   return v ? GPOINTER_TO_INT(v) : 0;
 }
@@ -30,6 +30,7 @@
 #include "memory.h"
 #include "module.h"
 #include "peripherals/scld.h"
+#include "profile.h"
 #include "rzx.h"
 #include "spectrum.h"
 #include "ui/ui.h"
@@ -159,6 +160,8 @@ z80_interrupt( void )
     
     IFF1=IFF2=0;
 
+    if( profile_active ) profile_interrupt();
+
     writebyte( --SP, PCH ); writebyte( --SP, PCL );
 
     R++; rzx_instructions_offset--;
@@ -195,6 +198,8 @@ z80_nmi( libspectrum_dword ts, int type, void *user_data )
 
   IFF1 = 0;
 
+  if( profile_active ) profile_interrupt();
+
   writebyte( --SP, PCH ); writebyte( --SP, PCL );
 
   if( machine_current->capabilities &
@@ -31,6 +31,7 @@
 #include "event.h"
 #include "machine.h"
 #include "memory.h"
+#include "perf.h"
 #include "periph.h"
 #include "peripherals/disk/beta.h"
 #include "peripherals/disk/disciple.h"
@@ -44,6 +45,7 @@
 #include "settings.h"
 #include "slt.h"
 #include "tape.h"
+#include "trace.h"
 #include "z80.h"
 
 #include "z80_macros.h"
@@ -110,9 +112,19 @@ z80_do_opcodes( void )
   libspectrum_byte opcode = 0x00;
 #endif
 
+  perf_phase previous_phase = perf_enter( PERF_PHASE_Z80 );
+
   int even_m1 =
     machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_EVEN_M1; 
 
+  /* Can a halted Z80 be run straight through to the next event? Not if
+     anything in z80_checks.h wants to look at every opcode fetch */
+  int halt_fast_forward =
+    !( profile_active || trace_active || rzx_playback ||
+       debugger_mode != DEBUGGER_MODE_INACTIVE || beta_available ||
+       plusd_available || disciple_available || if1_available ||
+       settings_current.divide_enabled || opus_available );
+
 #ifdef __GNUC__
 
 #undef SETUP_CHECK
@@ -140,6 +152,13 @@ z80_do_opcodes( void )
 
     END_CHECK
 
+    /* Execution trace */
+    CHECK( trace, trace_active )
+
+    trace_instruction();
+
+    END_CHECK
+
     /* If we're due an end of frame from RZX playback, generate one */
     CHECK( rzx, rzx_playback )
 
@@ -221,7 +240,17 @@ z80_do_opcodes( void )
 
   run_opcode:
     /* Do the instruction fetch; readbyte_internal used here to avoid
-       triggering read breakpoints */
+       triggering read breakpoints.
+
+       This fetch and the contention above are all a cache of pre-decoded
+       instructions could save: the opcodes below fetch their operands
+       through readbyte(), contention and all, which exact timing needs
+       anyway. Taking the opcode from a perfect cache, with no lookup and
+       nothing to invalidate, made a straight-line loop of loads, ALU,
+       CB- and DD-prefixed opcodes and LDIR only 14% faster; a real cache
+       would have to pay for a validity check on every fetch, and one on
+       every write and page remap, out of that. So there is no such
+       cache */
     opcode = readbyte_internal( PC );
 
     CHECK( if1u, if1_available )
@@ -261,8 +290,30 @@ z80_do_opcodes( void )
 #include "opcodes_base.c"
     }
 
+    /* While halted, the Z80 keeps executing the HALT, each time taking
+       four tstates plus any contention and incrementing R. Do all of
+       those executions up to the next event in one go */
+    if( z80.halted && halt_fast_forward && readbyte_internal( PC ) == 0x76 &&
+        tstates < event_next_event ) {
+
+      if( !even_m1 &&
+          !memory_map_read[ PC >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) {
+        libspectrum_dword halts = ( event_next_event - tstates - 1 ) / 4 + 1;
+        tstates += 4 * halts;
+        R += halts;
+      } else {
+        while( tstates < event_next_event ) {
+          contend_read( PC, 4 );
+          if( even_m1 && ( tstates & 1 ) ) tstates++;
+          R++;
+        }
+      }
+
+    }
+
   }
 
+  perf_leave( previous_phase );
 }
 
 #ifndef HAVE_ENOUGH_MEMORY